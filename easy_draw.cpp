@@ -17,6 +17,7 @@
 #include <d2d1_1helper.h>
 #include <dwrite.h>
 #include <dcomp.h>
+#include <dwmapi.h>
 #include <wincodec.h>
 #include <ShlObj.h>
 #include <KnownFolders.h>
@@ -24,7 +25,6 @@
 #include <vector>
 #include <string>
 #include <map>
-#include <stack>
 #include <fstream>
 #include <sstream>
 #include <algorithm>
@@ -34,6 +34,20 @@
 #include <cstdint>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define EASY_DRAW_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 
 using std::vector;
 using std::wstring;
@@ -42,12 +56,41 @@ using std::map;
 using std::max;
 using std::min;
 
+// ---------- Allocation counter ----------
+// Debug builds (or -DEASY_DRAW_COUNT_ALLOCS=1) replace the global operator new to count the heap
+// allocations each thread makes, so hot paths can assert they stay off the heap (see
+// AddToStroke). The replacement covers the whole program, but D2D, DirectWrite and the driver
+// allocate through their own heaps and are not seen.
+#if defined(_DEBUG) && !defined(EASY_DRAW_COUNT_ALLOCS)
+#define EASY_DRAW_COUNT_ALLOCS 1
+#endif
+#if EASY_DRAW_COUNT_ALLOCS
+#include <cassert>
+#include <cstdlib>
+#include <new>
+static thread_local size_t g_allocCount = 0;
+void* operator new(size_t n) {
+	++g_allocCount;
+	if (void* p = malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {
+	free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+#endif
+
 // ---------- DPI awareness ----------
 #ifndef DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2
 typedef HANDLE DPI_AWARENESS_CONTEXT;
 #define DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2 ((DPI_AWARENESS_CONTEXT)-4)
 #define DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE    ((DPI_AWARENESS_CONTEXT)-3)
 #endif
+#ifndef WDA_EXCLUDEFROMCAPTURE
+#define WDA_EXCLUDEFROMCAPTURE 0x00000011
+#endif
 typedef BOOL (WINAPI *PFN_SetProcessDpiAwarenessContext)(DPI_AWARENESS_CONTEXT);
 typedef HRESULT (WINAPI *PFN_SetProcessDpiAwareness)(int);
 
@@ -74,7 +117,7 @@ static void EnableDpiAwarenessOnce() {
 }
 
 // ---------- Model ----------
-enum class CmdType { Stroke, Text };
+enum class CmdType { Stroke, Text, Raster };
 
 struct Style {
 	D2D1_COLOR_F color{ D2D1::ColorF(1.f, 0.f, 0.f, 1.f) };
@@ -82,14 +125,199 @@ struct Style {
 	float width = 6.f, hiWidth = 60.f;
 };
 
+// Pixels of flattened commands (see Flattening): premultiplied BGRA kept as a QOI stream,
+// decoded into `bmp` on first draw.
+struct RasterLayer {
+	int x = 0, y = 0, w = 0, h = 0;
+	vector<uint8_t> qoi;
+	mutable ID2D1Bitmap1* bmp = nullptr;
+	~RasterLayer() {
+		if (bmp) bmp->Release();
+	}
+};
+
+// Owning reference to a COM object that copies by AddRef, so sharing one costs no allocation.
+template<typename T> struct ComRef {
+	T* p = nullptr;
+	ComRef() = default;
+	ComRef(const ComRef& o) : p(o.p) {
+		if (p) p->AddRef();
+	}
+	ComRef(ComRef&& o) noexcept : p(o.p) {
+		o.p = nullptr;
+	}
+	ComRef& operator=(ComRef o) noexcept {
+		std::swap(p, o.p);
+		return *this;
+	}
+	~ComRef() {
+		if (p) p->Release();
+	}
+	void reset(T* q = nullptr) {   // takes over the caller's reference
+		ComRef old;
+		old.p = p;
+		p = q;
+	}
+	T* get() const { return p; }
+	explicit operator bool() const { return p != nullptr; }
+};
+
+// Stroke points are cut from large shared chunks instead of one heap block per stroke, so
+// committing a stroke costs no allocation and a board's points sit next to each other in
+// drawing order. A chunk is freed when the last slice into it goes; ResetPointArena retires
+// the chunk new slices come from (DeleteAll, flattening) so old ones can drain.
+static const size_t POINT_CHUNK = 65536;   // points per chunk (512 KB); bigger strokes get their own
+std::atomic<size_t>   g_ptArenaBytes{0};
+std::atomic<uint32_t> g_ptArenaChunks{0};
+struct PointChunk {
+	std::unique_ptr<D2D1_POINT_2F[]> pts;
+	size_t   cap = 0, top = 0;
+	uint64_t owner = 0;   // slice ending at `top`, the only one allowed to grow in place
+	explicit PointChunk(size_t n) : pts(new D2D1_POINT_2F[n]), cap(n) {
+		g_ptArenaBytes += n * sizeof(D2D1_POINT_2F);
+		++g_ptArenaChunks;
+	}
+	~PointChunk() {
+		g_ptArenaBytes -= cap * sizeof(D2D1_POINT_2F);
+		--g_ptArenaChunks;
+	}
+};
+std::shared_ptr<PointChunk> g_ptChunk;   // chunk new slices are cut from (main thread only)
+uint64_t g_ptSliceId = 0;
+
+static void ResetPointArena() {
+	g_ptChunk.reset();
+}
+
+// A stroke's points: a slice of a PointChunk. Copies share the slice (the compaction snapshot
+// and session history cost no point copies) and move to a fresh slice before they grow.
+// Only the main thread grows or creates slices; other threads only read and drop them.
+class PointBuf {
+public:
+	PointBuf() = default;
+	PointBuf(const PointBuf& o) : chunk_(o.chunk_), p_(o.p_), n_(o.n_), cap_(o.n_) {}
+	PointBuf(PointBuf&& o) noexcept : chunk_(std::move(o.chunk_)), p_(o.p_), n_(o.n_), cap_(o.cap_), id_(o.id_) {
+		o.p_ = nullptr;
+		o.n_ = o.cap_ = 0;
+		o.id_ = 0;
+	}
+	PointBuf& operator=(const PointBuf& o) {
+		if (this != &o) *this = PointBuf(o);
+		return *this;
+	}
+	PointBuf& operator=(PointBuf&& o) noexcept {
+		chunk_ = std::move(o.chunk_);
+		p_ = o.p_; n_ = o.n_; cap_ = o.cap_; id_ = o.id_;
+		o.p_ = nullptr;
+		o.n_ = o.cap_ = 0;
+		o.id_ = 0;
+		return *this;
+	}
+	PointBuf& operator=(const vector<D2D1_POINT_2F>& v) {
+		PointBuf b;
+		b.reserve(v.size());
+		if (!v.empty()) memcpy(b.p_, v.data(), v.size() * sizeof(D2D1_POINT_2F));
+		b.n_ = v.size();
+		return *this = std::move(b);
+	}
+
+	size_t size() const { return n_; }
+	size_t capacity() const { return cap_; }
+	bool   empty() const { return n_ == 0; }
+	D2D1_POINT_2F*       data() { return p_; }
+	const D2D1_POINT_2F* data() const { return p_; }
+	D2D1_POINT_2F*       begin() { return p_; }
+	const D2D1_POINT_2F* begin() const { return p_; }
+	D2D1_POINT_2F*       end() { return p_ + n_; }
+	const D2D1_POINT_2F* end() const { return p_ + n_; }
+	D2D1_POINT_2F&       operator[](size_t i) { return p_[i]; }
+	const D2D1_POINT_2F& operator[](size_t i) const { return p_[i]; }
+	D2D1_POINT_2F&       back() { return p_[n_ - 1]; }
+	const D2D1_POINT_2F& back() const { return p_[n_ - 1]; }
+
+	void push_back(D2D1_POINT_2F pt) {
+		if (n_ == cap_) Grow(n_ + 1);
+		p_[n_++] = pt;
+	}
+	void reserve(size_t n) {
+		if (n > cap_) Grow(n);
+	}
+	void resize(size_t n) {
+		if (n < n_) cap_ = n;   // a copy may still share the dropped points; grow elsewhere
+		reserve(n);
+		for (size_t i = n_; i < n; ++i) p_[i] = D2D1_POINT_2F{0, 0};
+		n_ = n;
+	}
+	// Hands the unused tail back to the chunk when nothing was cut after this slice.
+	void shrink_to_fit() {
+		if (OwnsTop()) {
+			chunk_->top -= cap_ - n_;
+			cap_ = n_;
+		}
+	}
+
+private:
+	bool OwnsTop() const {
+		return id_ && chunk_ && chunk_->owner == id_ && chunk_->pts.get() + chunk_->top == p_ + cap_;
+	}
+	void Grow(size_t need) {
+		size_t want = std::max(need, std::max<size_t>(64, cap_ * 2));
+		if (OwnsTop() && chunk_->cap - chunk_->top >= need - cap_) {   // extend where it is
+			size_t add = std::min(want - cap_, chunk_->cap - chunk_->top);
+			chunk_->top += add;
+			cap_ += add;
+			return;
+		}
+		std::shared_ptr<PointChunk> dst;
+		if (want >= POINT_CHUNK) dst = std::make_shared<PointChunk>(want);
+		else {
+			if (!g_ptChunk || g_ptChunk->cap - g_ptChunk->top < want) g_ptChunk = std::make_shared<PointChunk>(POINT_CHUNK);
+			dst = g_ptChunk;
+		}
+		D2D1_POINT_2F* q = dst->pts.get() + dst->top;
+		dst->top += want;
+		dst->owner = id_ = ++g_ptSliceId;
+		if (n_) memcpy(q, p_, n_ * sizeof(D2D1_POINT_2F));
+		chunk_ = std::move(dst);
+		p_ = q;
+		cap_ = want;
+	}
+
+	std::shared_ptr<PointChunk> chunk_;
+	D2D1_POINT_2F* p_ = nullptr;
+	size_t   n_ = 0, cap_ = 0;
+	uint64_t id_ = 0;   // nonzero while this buffer may grow in place
+};
+
 struct Command {
 	CmdType type{};
 	Style   style{};
 	bool    eraser = false, highlight = false;
-	vector<D2D1_POINT_2F> pts;
+	PointBuf pts;
 	wstring text;
 	float   textSize = 0.f;
 	D2D1_POINT_2F pos{0, 0};
+	std::shared_ptr<const RasterLayer> raster;   // Raster only
+	// Drawn extent, filled in by CommandBounds on first use.
+	mutable D2D1_RECT_F bounds{0, 0, 0, 0};
+	mutable bool        hasBounds = false;
+	// Stroke outline built by StrokeGeometry on first draw, with the pts buffer and count it
+	// was built from; a different buffer or count rebuilds it.
+	mutable ComRef<ID2D1Geometry>          geom;
+	mutable const D2D1_POINT_2F*           geomOf = nullptr;
+	mutable size_t                         geomPts = 0;
+};
+
+// Undo history entry. Add is undone by popping the last command, Erase by putting the removed
+// commands back where they were, Replace (D, board load) by swapping the whole board back.
+enum class EditKind { Add, Erase, Replace };
+struct EditOp {
+	EditKind kind = EditKind::Add;
+	Command  cmd;                // Add: the command, while on the redo stack
+	vector<uint32_t> at;         // Erase: positions the removed commands had, ascending
+	vector<Command>  cmds;       // Erase: the removed commands; Replace: the other board
+	uint32_t hist = 0;           // Erase: its record in g_histErases
+	uint32_t low = 0;            // lowest board position the op touches (see SealedPrefix)
 };
 
 enum class UIMode { Draw, Erase, Text };
@@ -103,11 +331,39 @@ int   g_w = 0, g_h = 0, g_vx = 0, g_vy = 0;
 bool  g_passThrough = true;
 
 vector<Command>     g_cmds;
-std::stack<Command> g_redo;
-std::stack<vector<Command >> g_undoSnaps, g_redoSnaps;
+std::deque<EditOp>  g_undoOps, g_redoOps;
+int                 g_undoDepth = 0;     // UNDO_DEPTH; 0 = unlimited
+int                 g_flattenMB = 4;     // FLATTEN_MB; 0 = never flatten
+int                 g_memBudgetMB = 1024; // MEMORY_BUDGET_MB; 0 = no budget
+uint64_t            g_boardEpoch = 0;    // bumped by every change other than an append
+
+// Session history (see Session history) and the replay viewer. Event ops are the journal's
+// JR_ADD / JR_POP / JR_CLEAR; id indexes g_histCmds for adds.
+struct HistEvent { uint32_t ms; uint8_t op; uint32_t id; };
+struct HistKeyframe { size_t event = 0; vector<uint32_t> board; };   // board after `event` events
+struct HistErase { vector<uint32_t> at, ids; };   // positions (ascending) and the ids there
+vector<HistErase>    g_histErases;    // JR_ERASE / JR_INSERT events index this
+vector<Command>      g_histCmds;
+vector<HistEvent>    g_histEvents;
+vector<HistKeyframe> g_histKeys;
+vector<uint32_t>     g_histBoard;     // mirrors g_cmds as ids, past the flattened lead
+// Flattening is not a history event: the first g_histLead ids of g_histBoard are what the first
+// g_cmdLead commands of g_cmds (the raster, if the flattened ink had any extent) stand for.
+size_t               g_histLead = 0, g_cmdLead = 0;
+ULONGLONG            g_histStart = 0;
+bool     g_replaying = false, g_rpPlaying = false, g_rpWasPass = true;
+uint32_t g_rpClock = 0, g_rpDuration = 0;   // ms into the session
+float    g_rpSpeed = 1.f;
+size_t   g_rpApplied = 0, g_rpEnd = 0;       // events shown / events recorded when replay began
+vector<uint32_t> g_rpBoard;
+ULONGLONG g_rpLastTick = 0;
 
 Command g_live;
 bool  g_drawing = false, g_textMode = false, g_eraser = false, g_highlight = false;
+// Object eraser (Ctrl+E): with g_eraser set, strokes remove whole commands instead of painting.
+bool  g_objectEraser = false, g_objErasing = false;
+vector<uint8_t> g_objHidden;   // per g_cmds index, removed by the gesture in progress
+D2D1_POINT_2F   g_objLast{0, 0};
 static bool g_swallowToggleKey = false;
 
 map<WPARAM, Style> g_styleKeys;
@@ -124,7 +380,14 @@ bool           g_prevEraser = false, g_prevHighlight = false;
 bool           g_armStrokeAfterText = false;
 D2D1_POINT_2F  g_armStart{0, 0};
 
-vector<wstring> g_textUndoStack, g_textRedoStack;
+// One live-text edit: `span` inserted at, or deleted from, offset `at` (see Text edit).
+struct TextOp {
+	bool     insert = true;
+	uint32_t at = 0;
+	wstring  span;
+};
+vector<TextOp> g_textUndoOps, g_textRedoOps;
+size_t         g_liveTextDirty = 0;   // the cached live layout is good for text before this offset
 
 int   g_eraserMin = 20, g_eraserMax = 200, g_eraserSize = 50, g_eraserStep = 5;
 
@@ -133,6 +396,7 @@ bool          g_haveMousePos = false;
 bool          g_touchActive  = false;
 
 int   g_highlightAlpha = 50, g_highlightWidthMultiple = 10;
+int   g_inkPredictMs = 0;   // INK_PREDICT_MS; 0 = no predicted tail
 
 UIMode g_prevMode = UIMode::Draw;
 
@@ -141,13 +405,21 @@ UIMode g_prevMode = UIMode::Draw;
 static UINT  g_msgTaskbarCreated = 0;
 static HICON g_hTrayIcon = nullptr;
 
-enum { IDM_TRAY_OPENCFG = 10, IDM_TRAY_EXIT = 99 };
+enum { IDM_TRAY_OPENCFG = 10, IDM_TRAY_EXPORTINK = 11, IDM_TRAY_TELEMETRY = 12, IDM_TRAY_TIMELAPSE = 13, IDM_TRAY_SAVEBOARD = 14, IDM_TRAY_LOADBOARD = 15, IDM_TRAY_EXIT = 99 };
 
 struct Combo { bool ctrl = false; UINT vk = 0; };
 Combo  g_keyToggle{ true, '2' };
 Combo  g_keyUndo  { true, 'Z' };
 Combo  g_keyRedo  { true, 'A' };
 Combo  g_keyAreaShot{ true, 'S' };
+Combo  g_keyInkShot { true, 'N' };
+Combo  g_keyClipShot{ false, 'X' };
+Combo  g_keyClipAreaShot{ true, 'X' };
+Combo  g_keyTimelapse{ true, 'T' };
+Combo  g_keyBoardSave{ true, 'F' };
+Combo  g_keyBoardLoad{ true, 'L' };
+Combo  g_keyReplay{ true, 'H' };
+Combo  g_keyObjectEraser{ true, 'E' };
 
 WPARAM g_keyDeleteAll = 'D';
 WPARAM g_keyEraser    = 'E';
@@ -169,18 +441,34 @@ int   g_ssTextSize = 28;
 int   g_ssTextR = 255, g_ssTextG = 255, g_ssTextB = 255, g_ssTextA = 255;
 int   g_ssBgR   = 0,   g_ssBgG   = 0,   g_ssBgB   = 0,   g_ssBgA   = 255;
 bool  g_toastVisible = false;
+wstring g_toastText = L"Screenshot Saved.";
 ULONGLONG g_toastDeadline = 0;
 const UINT TOAST_TIMER_ID = 1001;
+const UINT REPLAY_TIMER_ID = 1002;
+const UINT COMPACT_TIMER_ID = 1003;
+const UINT PACE_TIMER_ID = 1004;
 // toast-on-one-monitor control
 bool  g_toastOneMonitor = false;
 RECT  g_toastMonRect{0, 0, 0, 0};
 
-// Async screenshot state
+// Async screenshot state: wParam = saved ok, lParam = job id
 static const UINT WM_APP_SAVEDONE = WM_APP + 100;
-// area screenshot done message
-static const UINT WM_APP_AREASAVEDONE = WM_APP + 101;
 
-std::atomic<bool> g_ssBusy{false};
+// Capture buffer pool (bounded; see AcquireCaptureSlot)
+int    g_ssPoolSlots = 2;
+int    g_ssQueueMB = 512;    // memory screenshots still being saved may hold
+int    g_ssEncoders = 2;     // encode-stage workers
+// What a full screenshot (S) grabs: the virtual desktop, the monitor under the cursor, or
+// monitor g_ssMonitor (1-based, EnumDisplayMonitors order).
+enum { SSMODE_DESKTOP, SSMODE_CURSOR, SSMODE_MONITOR };
+int    g_ssMode = SSMODE_DESKTOP;
+int    g_ssMonitor = 1;
+int    g_tlIntervalSec = 30;   // timelapse capture interval
+int    g_ssScalePct = 100;     // saved screenshot size, percent of the capture
+int    g_ssThumbWidth = 0;     // extra _thumb file this wide (0 = none)
+int    g_pngLevel = 4;   // built-in PNG writer, 0 (fastest) .. 9 (smallest)
+int    g_ssFormat = 0;   // index into g_imageFormats
+bool   g_journal = true; // crash-recovery journal (see Crash journal)
 
 // ---------- Magnifier ----------
 bool g_magnify = false, g_magSelecting = false, g_magHasRect = false;
@@ -214,6 +502,7 @@ static UINT32 g_activePointerId = 0;
 
 // Region screenshot state ----------
 bool g_areaShot = false, g_areaSelecting = false;
+bool g_areaToClipboard = false;   // the current area selection goes to the clipboard
 D2D1_POINT_2F g_areaSelStart{0, 0}, g_areaSelCur{0, 0};
 RECT g_areaToastMonRect{0, 0, 0, 0};
 
@@ -222,13 +511,28 @@ ID3D11Device*        g_d3d = nullptr;
 ID3D11DeviceContext* g_immediate = nullptr;
 IDXGIDevice*         g_dxgiDevice = nullptr;
 IDXGIFactory2*       g_dxgiFactory = nullptr;
-IDXGISwapChain1*     g_swap = nullptr;
 
 ID2D1Factory1*       g_d2dFactory = nullptr;
 ID2D1Device*         g_d2dDevice = nullptr;
 ID2D1DeviceContext*  g_dc = nullptr;
-ID2D1Bitmap1*        g_target = nullptr;
-ID2D1Bitmap1*        g_contentBmp = nullptr;
+// One composition swap chain per monitor, placed at the monitor's offset inside the overlay
+// window, so gaps between monitors own no buffers and each chain presents at its own rate.
+struct Surface {
+	RECT                 rc{};               // client coordinates
+	IDXGISwapChain1*     swap = nullptr;
+	ID2D1Bitmap1*        target = nullptr;
+	IDCompositionVisual* visual = nullptr;
+	HANDLE               wait = nullptr;     // frame latency waitable, signalled when a frame may be queued
+	bool                 stale = false;      // skipped while its monitor was busy; redrawn by PACE_TIMER_ID
+};
+vector<Surface>      g_surfaces;
+// Committed content, in CONTENT_TILE px tiles (see Cached content); nullptr = transparent.
+static const int      CONTENT_TILE = 256;
+vector<ID2D1Bitmap1*> g_tiles;                // row-major, g_tilesX per row
+int                   g_tilesX = 0, g_tilesY = 0;
+size_t                g_tileCount = 0;        // allocated tiles
+std::atomic<uint32_t> g_contentVersion{0};   // bumped whenever the content tiles are redrawn
+ID2D1Bitmap1*        g_readbackBmp = nullptr;
 ID2D1StrokeStyle*    g_roundStroke = nullptr;
 
 IDWriteFactory*      g_dw = nullptr;
@@ -253,6 +557,31 @@ static void FailIf(HRESULT hr, const wchar_t* where) {
 static inline Style& ActiveStyle() {
 	return g_styleKeys[g_currentKey];
 }
+// Stable removal of the elements at ascending positions `at`, moving them to `removed` if given.
+template<typename T> static void EraseAt(vector<T>& v, const vector<uint32_t>& at, vector<T>* removed = nullptr) {
+	size_t k = 0, out = 0;
+	for (size_t i = 0; i < v.size(); ++i) {
+		if (k < at.size() && at[k] == i) {
+			++k;
+			if (removed) removed->push_back(std::move(v[i]));
+			continue;
+		}
+		if (out != i) v[out] = std::move(v[i]);
+		++out;
+	}
+	v.resize(out);
+}
+// Inverse of EraseAt: items[k] ends up at position at[k].
+template<typename T> static void InsertAt(vector<T>& v, const vector<uint32_t>& at, vector<T>& items) {
+	vector<T> merged;
+	merged.reserve(v.size() + items.size());
+	size_t k = 0, src = 0;
+	for (size_t i = 0; i < v.size() + items.size(); ++i) {
+		if (k < at.size() && at[k] == i) merged.push_back(std::move(items[k++]));
+		else merged.push_back(std::move(v[src++]));
+	}
+	v.swap(merged);
+}
 
 // ---------- Icon for tray ----------
 static HICON CreateLetterIconW(wchar_t ch, int size, COLORREF rgbText) {
@@ -407,33 +736,103 @@ static HICON LoadTrayIconFromFileOrGenerate() {
 }
 
 // ---------- DX setup ----------
-static void BuildTargetBitmap() {
-	SafeRelease(g_target);
-	SafeRelease(g_contentBmp);
+static void FreeContentTiles() {
+	for (ID2D1Bitmap1*& t : g_tiles) SafeRelease(t);
+	g_tileCount = 0;
+}
+static void ResetContentTiles() {
+	FreeContentTiles();
+	g_tilesX = (g_w + CONTENT_TILE - 1) / CONTENT_TILE;
+	g_tilesY = (g_h + CONTENT_TILE - 1) / CONTENT_TILE;
+	g_tiles.assign((size_t)g_tilesX * g_tilesY, nullptr);
+}
+// Monitor rectangles in screen coordinates as of the last MonitorRects() call, i.e. the last
+// surface check. Per-frame overlays (toast, replay bar) read these instead of enumerating,
+// so drawing them never allocates.
+vector<RECT> g_monitors;
+
+// Monitor rectangles in client coordinates, clipped to the overlay window. Refreshes g_monitors.
+static vector<RECT> MonitorRects() {
+	struct MonCtx {
+		static BOOL CALLBACK CB(HMONITOR, HDC, LPRECT prc, LPARAM lp) {
+			((vector<RECT>*)lp)->push_back(*prc);
+			return TRUE;
+		}
+	};
+	g_monitors.clear();
+	EnumDisplayMonitors(nullptr, nullptr, MonCtx::CB, (LPARAM)&g_monitors);
+	vector<RECT> out;
+	const RECT client{ 0, 0, g_w, g_h };
+	for (const RECT& m : g_monitors) {
+		RECT r{ m.left - g_vx, m.top - g_vy, m.right - g_vx, m.bottom - g_vy }, c{};
+		if (IntersectRect(&c, &r, &client)) out.push_back(c);
+	}
+	if (out.empty() && g_w > 0 && g_h > 0) out.push_back(client);
+	return out;
+}
+static bool SurfacesMatch(const vector<RECT>& rects) {
+	if (rects.size() != g_surfaces.size()) return false;
+	for (size_t i = 0; i < rects.size(); ++i)
+		if (memcmp(&rects[i], &g_surfaces[i].rc, sizeof(RECT)) != 0) return false;
+	return true;
+}
+static void FreeSurfaces() {
+	if (g_dc) g_dc->SetTarget(nullptr);
+	if (g_visual) g_visual->RemoveAllVisuals();
+	for (Surface& s : g_surfaces) {
+		SafeRelease(s.target);
+		SafeRelease(s.visual);
+		SafeRelease(s.swap);
+		if (s.wait) CloseHandle(s.wait);
+	}
+	g_surfaces.clear();
+}
+static void BuildSurface(Surface& s) {
+	const UINT w = (UINT)(s.rc.right - s.rc.left), h = (UINT)(s.rc.bottom - s.rc.top);
+	DXGI_SWAP_CHAIN_DESC1 desc{};
+	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+	desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+	desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+	desc.BufferCount = 2;
+	desc.SampleDesc.Count = 1;
+	desc.AlphaMode = DXGI_ALPHA_MODE_PREMULTIPLIED;
+	desc.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+	desc.Width = w;
+	desc.Height = h;
+	FailIf(g_dxgiFactory->CreateSwapChainForComposition(g_dxgiDevice, &desc, nullptr, &s.swap), L"CreateSwapChainForComposition");
+	if (IDXGISwapChain2* sc2 = nullptr; SUCCEEDED(s.swap->QueryInterface(__uuidof(IDXGISwapChain2), (void**)&sc2))) {
+		sc2->SetMaximumFrameLatency(1);
+		s.wait = sc2->GetFrameLatencyWaitableObject();
+		sc2->Release();
+	}
 	IDXGISurface* surf = nullptr;
-	FailIf(g_swap->GetBuffer(0, __uuidof(IDXGISurface), (void**)&surf), L"GetBuffer");
+	FailIf(s.swap->GetBuffer(0, __uuidof(IDXGISurface), (void**)&surf), L"GetBuffer");
 	D2D1_BITMAP_PROPERTIES1 props{};
 	props.pixelFormat = {DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED};
 	props.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET | D2D1_BITMAP_OPTIONS_CANNOT_DRAW;
 	props.dpiX = 96.f;
 	props.dpiY = 96.f;
-	FailIf(g_dc->CreateBitmapFromDxgiSurface(surf, &props, &g_target), L"CreateBitmapFromDxgiSurface");
+	FailIf(g_dc->CreateBitmapFromDxgiSurface(surf, &props, &s.target), L"CreateBitmapFromDxgiSurface");
 	SafeRelease(surf);
-	g_dc->SetTarget(g_target);
-	g_dc->SetAntialiasMode(D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
-	SafeRelease(g_roundStroke);
-	D2D1_STROKE_STYLE_PROPERTIES ssp{};
-	ssp.startCap = D2D1_CAP_STYLE_ROUND;
-	ssp.endCap   = D2D1_CAP_STYLE_ROUND;
-	ssp.lineJoin = D2D1_LINE_JOIN_ROUND;
-	g_d2dFactory->CreateStrokeStyle(ssp, nullptr, 0, &g_roundStroke);
-	D2D1_BITMAP_PROPERTIES1 props2{};
-	props2.pixelFormat = {DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED};
-	props2.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET;
-	props2.dpiX = 96.f;
-	props2.dpiY = 96.f;
-	D2D1_SIZE_U sz{ (UINT32)g_w, (UINT32)g_h };
-	FailIf(g_dc->CreateBitmap(sz, nullptr, 0, &props2, &g_contentBmp), L"CreateBitmap (contentBmp)");
+	FailIf(g_dcomp->CreateVisual(&s.visual), L"CreateVisual");
+	FailIf(s.visual->SetContent(s.swap), L"Visual::SetContent");
+	s.visual->SetOffsetX((float)s.rc.left);
+	s.visual->SetOffsetY((float)s.rc.top);
+	FailIf(g_visual->AddVisual(s.visual, FALSE, nullptr), L"Visual::AddVisual");
+}
+// (Re)creates one surface per monitor. The process is per-monitor DPI
+// aware, so client coordinates are physical pixels on every monitor and each target maps 1:1
+// onto its monitor at that monitor's own density.
+static void BuildSurfaces() {
+	if (!g_dcomp) return;
+	FreeSurfaces();
+	SafeRelease(g_readbackBmp);
+	for (const RECT& r : MonitorRects()) {
+		g_surfaces.emplace_back();
+		g_surfaces.back().rc = r;
+		BuildSurface(g_surfaces.back());
+	}
+	FailIf(g_dcomp->Commit(), L"DComp Commit");
 }
 static void InitGraphics(HWND hwnd) {
 	RECT rc{};
@@ -452,37 +851,24 @@ static void InitGraphics(HWND hwnd) {
 	
 	FailIf(g_d3d->QueryInterface(__uuidof(IDXGIDevice), (void**)&g_dxgiDevice), L"Query IDXGIDevice");
 	FailIf(CreateDXGIFactory1(__uuidof(IDXGIFactory2), (void**)&g_dxgiFactory), L"CreateDXGIFactory1/IDXGIFactory2");
-	DXGI_SWAP_CHAIN_DESC1 desc{};
-	desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
-	desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
-	desc.BufferCount = 2;
-	desc.SampleDesc.Count = 1;
-	desc.AlphaMode = DXGI_ALPHA_MODE_PREMULTIPLIED;
-	desc.Width = g_w;
-	desc.Height = g_h;
-	FailIf(g_dxgiFactory->CreateSwapChainForComposition(g_dxgiDevice, &desc, nullptr, &g_swap), L"CreateSwapChainForComposition");
 	D2D1_FACTORY_OPTIONS opts{};
 	FailIf(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, __uuidof(ID2D1Factory1), &opts, (void**)&g_d2dFactory), L"D2D1CreateFactory");
 	FailIf(g_d2dFactory->CreateDevice(g_dxgiDevice, &g_d2dDevice), L"CreateDevice");
 	FailIf(g_d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &g_dc), L"CreateDeviceContext");
 	FailIf(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), (IUnknown**)&g_dw), L"DWriteCreateFactory");
 	if (!g_wic) CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (void * *)&g_wic);
-	BuildTargetBitmap();
+	g_dc->SetAntialiasMode(D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
+	D2D1_STROKE_STYLE_PROPERTIES ssp{};
+	ssp.startCap = D2D1_CAP_STYLE_ROUND;
+	ssp.endCap   = D2D1_CAP_STYLE_ROUND;
+	ssp.lineJoin = D2D1_LINE_JOIN_ROUND;
+	g_d2dFactory->CreateStrokeStyle(ssp, nullptr, 0, &g_roundStroke);
 	FailIf(DCompositionCreateDevice(g_dxgiDevice, __uuidof(IDCompositionDevice), (void**)&g_dcomp), L"DCompositionCreateDevice");
 	FailIf(g_dcomp->CreateTargetForHwnd(hwnd, TRUE, &g_compTarget), L"CreateTargetForHwnd");
 	FailIf(g_dcomp->CreateVisual(&g_visual), L"CreateVisual");
-	FailIf(g_visual->SetContent(g_swap), L"Visual::SetContent");
 	FailIf(g_compTarget->SetRoot(g_visual), L"Target::SetRoot");
-	FailIf(g_dcomp->Commit(), L"DComp Commit");
-}
-static void ResizeSwapChain(UINT w, UINT h) {
-	if (!g_swap) return;
-	g_dc->SetTarget(nullptr);
-	SafeRelease(g_target);
-	SafeRelease(g_contentBmp);
-	FailIf(g_swap->ResizeBuffers(0, w, h, DXGI_FORMAT_UNKNOWN, 0), L"ResizeBuffers");
-	BuildTargetBitmap();
+	BuildSurfaces();
+	ResetContentTiles();
 }
 
 // ---------- Paths & encoding ----------
@@ -612,167 +998,1308 @@ static void RebuildBigCursor() {
 	DeleteObject(hbm);
 }
 
-// ---------- WIC (PNG) ----------
-static bool SaveWICBitmapToPNG(IWICBitmap* bmp, const wchar_t* path) {
-	if (!g_wic || !bmp || !path) return false;
-	IWICStream* stream = nullptr;
-	if (FAILED(g_wic->CreateStream(&stream))) return false;
-	if (FAILED(stream->InitializeFromFilename(path, GENERIC_WRITE))) {
-		SafeRelease(stream);
-		return false;
-	}
-	IWICBitmapEncoder* enc = nullptr;
-	IWICBitmapFrameEncode* frame = nullptr;
-	IPropertyBag2* pb = nullptr;
-	bool ok = false;
-	if (SUCCEEDED(g_wic->CreateEncoder(GUID_ContainerFormatPng, nullptr, &enc)) &&
-		SUCCEEDED(enc->Initialize(stream, WICBitmapEncoderNoCache)) &&
-		SUCCEEDED(enc->CreateNewFrame(&frame, &pb)) &&
-		SUCCEEDED(frame->Initialize(pb))) {
-		UINT w = 0, h = 0;
-		bmp->GetSize(&w, &h);
-		frame->SetSize(w, h);
-		WICPixelFormatGUID pf = GUID_WICPixelFormat32bppPBGRA;
-		frame->SetPixelFormat(&pf);
-		ok = SUCCEEDED(frame->WriteSource(bmp, nullptr)) && SUCCEEDED(frame->Commit()) && SUCCEEDED(enc->Commit());
+// ---------- Pixel pipeline (SIMD, runtime dispatch) ----------
+// One fused pass over a 32bpp BGRA capture: force opaque alpha, composite a premultiplied
+// BGRA overlay on top (source-over), then store as BGRA or pack to 3 bytes per pixel.
+// Packing may run in place (dst == src) because each store lands behind the next load.
+enum : unsigned {
+	PX_FORCE_ALPHA = 1u << 0,
+	PX_COMPOSE     = 1u << 1,
+	PX_PACK_RGB    = 1u << 2,
+	PX_PACK_BGR    = 1u << 3,
+};
+struct PixelJob {
+	const uint8_t* src = nullptr;
+	ptrdiff_t      srcStride = 0;
+	const uint8_t* overlay = nullptr;
+	ptrdiff_t      overlayStride = 0;
+	uint8_t*       dst = nullptr;
+	ptrdiff_t      dstStride = 0;
+	int            w = 0, h = 0;
+	unsigned       ops = 0;
+};
+typedef void (*PixelRowFn)(const uint32_t* s, const uint32_t* ov, uint8_t* d, int n, unsigned ops);
+
+static inline uint32_t Div255(uint32_t v) {
+	v += 128;
+	return (v + (v >> 8)) >> 8;
+}
+static void PixelRowScalar(const uint32_t* s, const uint32_t* ov, uint8_t* d, int n, unsigned ops) {
+	const uint32_t forceA = (ops & PX_FORCE_ALPHA) ? 0xFF000000u : 0u;
+	const bool packRGB = (ops & PX_PACK_RGB) != 0, packBGR = (ops & PX_PACK_BGR) != 0;
+	for (int x = 0; x < n; ++x) {
+		uint32_t p = s[x] | forceA;
+		if (ov) {
+			uint32_t o = ov[x], ia = 255u - (o >> 24);
+			if (ia == 0) p = o;
+			else if (ia != 255) {
+				uint32_t r = 0;
+				for (int sh = 0; sh < 32; sh += 8) r |= min(255u, ((o >> sh) & 0xFF) + Div255(((p >> sh) & 0xFF) * ia)) << sh;
+				p = r;
+			}
+		}
+		if (packRGB) {
+			d[x * 3 + 0] = (uint8_t)(p >> 16);
+			d[x * 3 + 1] = (uint8_t)(p >> 8);
+			d[x * 3 + 2] = (uint8_t)p;
+		} else if (packBGR) {
+			d[x * 3 + 0] = (uint8_t)p;
+			d[x * 3 + 1] = (uint8_t)(p >> 8);
+			d[x * 3 + 2] = (uint8_t)(p >> 16);
+		} else std::memcpy(d + x * 4, &p, 4);
 	}
-	SafeRelease(pb);
-	SafeRelease(frame);
-	SafeRelease(enc);
-	SafeRelease(stream);
-	return ok;
 }
-static wstring BuildTimestampedPath(const wstring& dir) {
-	SYSTEMTIME st;
-	GetLocalTime(&st);
-	wchar_t base[64];
-	swprintf(base, 64, L"%04d%02d%02d_%02d%02d%02d", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
-	wstring folder = dir.empty() ? GetDefaultPicturesDir() : dir;
-	if (!folder.empty() && folder.back() != L'\\' && folder.back() != L'/') folder += L'\\';
-	wstring path = folder + base + L".png";
-	int suffix = 1;
-	while (GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES) {
-		wchar_t sfx[16];
-		swprintf(sfx, 16, L"-%d", suffix++);
-		path = folder + base + sfx + L".png";
+
+#if EASY_DRAW_X86
+#if defined(__GNUC__) || defined(__clang__)
+#define PX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PX_TARGET(isa)
+#endif
+
+PX_TARGET("ssse3") static inline __m128i OverSSE(__m128i p, __m128i o, __m128i alphaShuf) {
+	const __m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi16(128);
+	__m128i ia = _mm_xor_si128(_mm_shuffle_epi8(o, alphaShuf), _mm_set1_epi8(-1));
+	__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), _mm_unpacklo_epi8(ia, zero)), bias);
+	__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), _mm_unpackhi_epi8(ia, zero)), bias);
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+	return _mm_adds_epu8(o, _mm_packus_epi16(lo, hi));
+}
+PX_TARGET("ssse3") static void PixelRowSSSE3(const uint32_t* s, const uint32_t* ov, uint8_t* d, int n, unsigned ops) {
+	const __m128i forceA = _mm_set1_epi32((ops & PX_FORCE_ALPHA) ? (int)0xFF000000u : 0);
+	const __m128i alphaShuf = _mm_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+	const bool pack = (ops & (PX_PACK_RGB | PX_PACK_BGR)) != 0;
+	const __m128i packShuf = (ops & PX_PACK_RGB)
+		? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+		: _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	// A packed store writes 16 bytes for 12 bytes of output, so keep 2 spare pixels.
+	const int simdEnd = n - (pack ? 6 : 4);
+	int x = 0;
+	for (; x <= simdEnd; x += 4) {
+		__m128i p = _mm_or_si128(_mm_loadu_si128((const __m128i*)(s + x)), forceA);
+		if (ov) {
+			__m128i o = _mm_loadu_si128((const __m128i*)(ov + x));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(o, 24), _mm_setzero_si128())) != 0xFFFF) p = OverSSE(p, o, alphaShuf);
+		}
+		if (pack) _mm_storeu_si128((__m128i*)(d + (size_t)x * 3), _mm_shuffle_epi8(p, packShuf));
+		else _mm_storeu_si128((__m128i*)(d + (size_t)x * 4), p);
 	}
-	return path;
+	if (x < n) PixelRowScalar(s + x, ov ? ov + x : nullptr, d + (size_t)x * (pack ? 3 : 4), n - x, ops);
 }
 
-static bool SavePNGFromMemoryToFile(const wchar_t* path, int w, int h, int stride, const BYTE* data) {
-	IWICImagingFactory* fac = nullptr;
-	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (void * *)&fac)))
-		return false;
-	IWICBitmap* wicMem = nullptr;
-	bool ok = SUCCEEDED(fac->CreateBitmapFromMemory((UINT)w, (UINT)h, GUID_WICPixelFormat32bppPBGRA, (UINT)stride, (UINT)(stride * h), const_cast<BYTE*>(data), &wicMem));
-	if (ok) {
-		IWICStream* stream = nullptr;
-		ok = SUCCEEDED(fac->CreateStream(&stream)) && SUCCEEDED(stream->InitializeFromFilename(path, GENERIC_WRITE));
-		if (ok) {
-			IWICBitmapEncoder* enc = nullptr;
-			ok = SUCCEEDED(fac->CreateEncoder(GUID_ContainerFormatPng, nullptr, &enc)) && SUCCEEDED(enc->Initialize(stream, WICBitmapEncoderNoCache));
-			if (ok) {
-				IWICBitmapFrameEncode* frame = nullptr;
-				IPropertyBag2* pb = nullptr;
-				ok = SUCCEEDED(enc->CreateNewFrame(&frame, &pb)) && SUCCEEDED(frame->Initialize(pb));
-				if (ok) {
-					ok = SUCCEEDED(frame->SetSize((UINT)w, (UINT)h));
-					WICPixelFormatGUID pf = GUID_WICPixelFormat32bppPBGRA;
-					ok = ok && SUCCEEDED(frame->SetPixelFormat(&pf));
-					ok = ok && SUCCEEDED(frame->WriteSource(wicMem, nullptr));
-					ok = ok && SUCCEEDED(frame->Commit()) && SUCCEEDED(enc->Commit());
-				}
-				SafeRelease(pb);
-				SafeRelease(frame);
+PX_TARGET("avx2") static void PixelRowAVX2(const uint32_t* s, const uint32_t* ov, uint8_t* d, int n, unsigned ops) {
+	const __m256i forceA = _mm256_set1_epi32((ops & PX_FORCE_ALPHA) ? (int)0xFF000000u : 0);
+	const __m256i alphaShuf = _mm256_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+	                                           3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+	const __m256i zero = _mm256_setzero_si256(), bias = _mm256_set1_epi16(128), ones = _mm256_set1_epi8(-1);
+	const bool pack = (ops & (PX_PACK_RGB | PX_PACK_BGR)) != 0;
+	const __m256i packShuf = (ops & PX_PACK_RGB)
+		? _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+		: _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	// Two 16-byte packed stores per 8 pixels; the second one spills 4 bytes.
+	const int simdEnd = n - (pack ? 10 : 8);
+	int x = 0;
+	for (; x <= simdEnd; x += 8) {
+		__m256i p = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(s + x)), forceA);
+		if (ov) {
+			__m256i o = _mm256_loadu_si256((const __m256i*)(ov + x));
+			if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_srli_epi32(o, 24), zero)) != 0xFFFFFFFFu) {
+				__m256i ia = _mm256_xor_si256(_mm256_shuffle_epi8(o, alphaShuf), ones);
+				__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(p, zero), _mm256_unpacklo_epi8(ia, zero)), bias);
+				__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(p, zero), _mm256_unpackhi_epi8(ia, zero)), bias);
+				lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+				hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+				p = _mm256_adds_epu8(o, _mm256_packus_epi16(lo, hi));
 			}
-			SafeRelease(enc);
 		}
-		SafeRelease(stream);
+		if (pack) {
+			__m256i q = _mm256_shuffle_epi8(p, packShuf);
+			_mm_storeu_si128((__m128i*)(d + (size_t)x * 3), _mm256_castsi256_si128(q));
+			_mm_storeu_si128((__m128i*)(d + (size_t)x * 3 + 12), _mm256_extracti128_si256(q, 1));
+		} else _mm256_storeu_si256((__m256i*)(d + (size_t)x * 4), p);
 	}
-	SafeRelease(wicMem);
-	SafeRelease(fac);
-	return ok;
+	if (x < n) PixelRowSSSE3(s + x, ov ? ov + x : nullptr, d + (size_t)x * (pack ? 3 : 4), n - x, ops);
 }
 
-// ---------- Config parsing ----------
-static UINT VKFromToken(const string& t0) {
-	string t = t0;
-	for (char& c : t) c = (char)toupper((unsigned char)c);
-	if (t.size() == 1) {
-		char c = t[0];
-		if (c >= 'A' && c <= 'Z') return 'A' + (c - 'A');
-		if (c >= '0' && c <= '9') return (UINT)c;
+static bool CpuHasSSSE3AndAVX2(bool& ssse3) {
+#if defined(_MSC_VER)
+	int info[4]{};
+	__cpuid(info, 1);
+	ssse3 = (info[2] & (1 << 9)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	ssse3 = __builtin_cpu_supports("ssse3");
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static PixelRowFn PixelRowKernel() {
+	static PixelRowFn fn = [] {
+		PixelRowFn f = PixelRowScalar;
+#if EASY_DRAW_X86
+		bool ssse3 = false;
+		bool avx2 = CpuHasSSSE3AndAVX2(ssse3);
+		if (avx2) f = PixelRowAVX2;
+		else if (ssse3) f = PixelRowSSSE3;
+#endif
+		return f;
+	}();
+	return fn;
+}
+static void RunPixelJob(const PixelJob& j) {
+	PixelRowFn row = PixelRowKernel();
+	const uint32_t* ov = nullptr;
+	for (int y = 0; y < j.h; ++y) {
+		const uint32_t* s = (const uint32_t*)(j.src + y * j.srcStride);
+		if (j.ops & PX_COMPOSE) ov = (const uint32_t*)(j.overlay + y * j.overlayStride);
+		row(s, ov, j.dst + y * j.dstStride, j.w, j.ops);
 	}
-	if (!t.empty() && t[0] == 'F') {
-		int n = atoi(t.c_str() + 1);
-		if (n >= 1 && n <= 24) return VK_F1 + (n - 1);
+}
+
+// ---------- Box resampler (SIMD, runtime dispatch) ----------
+// Area-averaging downscaler for 4-byte pixels. Separable: each output row first blends its
+// source rows (vectorized across the whole row), then each output pixel blends its source
+// columns. Weights are 14-bit fixed point and sum to exactly 1 << 14 per output sample.
+struct BoxTaps {
+	vector<int>     first, count, offset;
+	vector<int16_t> w;
+};
+static void BuildBoxTaps(int srcN, int dstN, BoxTaps& t) {
+	const double scale = (double)srcN / dstN;
+	t.first.resize(dstN);
+	t.count.resize(dstN);
+	t.offset.resize(dstN);
+	t.w.clear();
+	for (int i = 0; i < dstN; ++i) {
+		const double a = i * scale, b = min((double)srcN, (i + 1) * scale);
+		const int j0 = (int)a, j1 = min(srcN, (int)std::ceil(b - 1e-9));
+		t.first[i] = j0;
+		t.offset[i] = (int)t.w.size();
+		int sum = 0, big = (int)t.w.size();
+		for (int j = j0; j < j1; ++j) {
+			const double overlap = min(b, (double)j + 1) - max(a, (double)j);
+			const int wt = (int)std::lround(overlap / scale * 16384.0);
+			if (t.w.size() == (size_t)t.offset[i] || wt > t.w[big]) big = (int)t.w.size();
+			t.w.push_back((int16_t)wt);
+			sum += wt;
+		}
+		t.w[big] = (int16_t)(t.w[big] + (16384 - sum));
+		t.count[i] = j1 - j0;
 	}
-	if (t == "SPACE") return VK_SPACE;
-	if (t == "TAB") return VK_TAB;
-	if (t == "ESC" || t == "ESCAPE") return VK_ESCAPE;
-	if (t == "DELETE" || t == "DEL") return VK_DELETE;
-	if (t == "BACKSPACE" || t == "BS") return VK_BACK;
-	return 0;
 }
-static void ParseCombo(const string& rhs, Combo& out) {
-	out = Combo{};
-	string t = rhs;
-	for (char& c : t) if (c == '+') c = ' ';
-	std::istringstream ss(t);
-	string a, b;
-	ss >> a;
-	if (!(ss >> b)) {
-		out.ctrl = false;
-		out.vk = VKFromToken(a);
-		return;
+
+typedef void (*BoxRowsFn)(const uint8_t* const* rows, const int16_t* w, int count, uint8_t* dst, int bytes);
+typedef void (*BoxColsFn)(const uint8_t* row, const BoxTaps& t, uint8_t* dst, int dw);
+
+static void BoxRowsScalar(const uint8_t* const* rows, const int16_t* w, int count, uint8_t* dst, int bytes) {
+	for (int x = 0; x < bytes; ++x) {
+		int32_t sum = 8192;
+		for (int k = 0; k < count; ++k) sum += rows[k][x] * w[k];
+		dst[x] = (uint8_t)min(255, max(0, sum >> 14));
 	}
-	for (char& ch : a) ch = (char)toupper((unsigned char)ch);
-	out.ctrl = (a == "CTRL" || a == "CONTROL");
-	out.vk = VKFromToken(b);
 }
-static float ClampRegular(const Style& s, float v) {
-	return min(s.maxW, max(s.minW, v));
+static void BoxColsScalar(const uint8_t* row, const BoxTaps& t, uint8_t* dst, int dw) {
+	for (int i = 0; i < dw; ++i) {
+		const uint8_t* s = row + (size_t)t.first[i] * 4;
+		const int16_t* w = &t.w[t.offset[i]];
+		for (int c = 0; c < 4; ++c) {
+			int32_t sum = 8192;
+			for (int k = 0; k < t.count[i]; ++k) sum += s[k * 4 + c] * w[k];
+			dst[i * 4 + c] = (uint8_t)min(255, max(0, sum >> 14));
+		}
+	}
 }
-static float ClampHighlightToStyle(const Style& s, float v) {
-	float m = (float)max(1, g_highlightWidthMultiple);
-	return min(s.maxW * m, max(s.minW * m, v));
+
+#if EASY_DRAW_X86
+// Rows are taken in pairs so one madd applies both weights: interleave the two rows' 16-bit
+// samples and multiply-add against (w0, w1).
+PX_TARGET("sse2") static void BoxRowsSSE2(const uint8_t* const* rows, const int16_t* w, int count, uint8_t* dst, int bytes) {
+	const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi32(8192);
+	int x = 0;
+	for (; x + 16 <= bytes; x += 16) {
+		__m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+		for (int k = 0; k < count; k += 2) {
+			const bool pair = k + 1 < count;
+			const __m128i a = _mm_loadu_si128((const __m128i*)(rows[k] + x));
+			const __m128i b = pair ? _mm_loadu_si128((const __m128i*)(rows[k + 1] + x)) : zero;
+			const __m128i wt = _mm_set1_epi32((int)(uint16_t)w[k] | (pair ? (int)w[k + 1] << 16 : 0));
+			const __m128i alo = _mm_unpacklo_epi8(a, zero), ahi = _mm_unpackhi_epi8(a, zero);
+			const __m128i blo = _mm_unpacklo_epi8(b, zero), bhi = _mm_unpackhi_epi8(b, zero);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(alo, blo), wt));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(alo, blo), wt));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(ahi, bhi), wt));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(ahi, bhi), wt));
+		}
+		const __m128i lo = _mm_packs_epi32(_mm_srai_epi32(acc0, 14), _mm_srai_epi32(acc1, 14));
+		const __m128i hi = _mm_packs_epi32(_mm_srai_epi32(acc2, 14), _mm_srai_epi32(acc3, 14));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+	if (x < bytes) {
+		vector<const uint8_t*> tail(rows, rows + count);
+		for (auto& r : tail) r += x;
+		BoxRowsScalar(tail.data(), w, count, dst + x, bytes - x);
+	}
 }
-static void RecomputeHighlightDefaults() {
-	for (auto& kv : g_styleKeys) {
-		Style& s = kv.second;
-		float m = (float)max(1, g_highlightWidthMultiple);
-		if (s.hiWidth <= 0.f) s.hiWidth = s.width * m;
-		s.hiWidth = min(s.maxW * m, max(s.minW * m, s.hiWidth));
+PX_TARGET("avx2") static void BoxRowsAVX2(const uint8_t* const* rows, const int16_t* w, int count, uint8_t* dst, int bytes) {
+	const __m256i zero = _mm256_setzero_si256(), round = _mm256_set1_epi32(8192);
+	int x = 0;
+	for (; x + 32 <= bytes; x += 32) {
+		__m256i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+		for (int k = 0; k < count; k += 2) {
+			const bool pair = k + 1 < count;
+			const __m256i a = _mm256_loadu_si256((const __m256i*)(rows[k] + x));
+			const __m256i b = pair ? _mm256_loadu_si256((const __m256i*)(rows[k + 1] + x)) : zero;
+			const __m256i wt = _mm256_set1_epi32((int)(uint16_t)w[k] | (pair ? (int)w[k + 1] << 16 : 0));
+			const __m256i alo = _mm256_unpacklo_epi8(a, zero), ahi = _mm256_unpackhi_epi8(a, zero);
+			const __m256i blo = _mm256_unpacklo_epi8(b, zero), bhi = _mm256_unpackhi_epi8(b, zero);
+			acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_unpacklo_epi16(alo, blo), wt));
+			acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpackhi_epi16(alo, blo), wt));
+			acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi16(ahi, bhi), wt));
+			acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(_mm256_unpackhi_epi16(ahi, bhi), wt));
+		}
+		// The in-lane unpacks above are undone by the in-lane packs, so byte order is kept.
+		const __m256i lo = _mm256_packs_epi32(_mm256_srai_epi32(acc0, 14), _mm256_srai_epi32(acc1, 14));
+		const __m256i hi = _mm256_packs_epi32(_mm256_srai_epi32(acc2, 14), _mm256_srai_epi32(acc3, 14));
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_packus_epi16(lo, hi));
+	}
+	if (x < bytes) {
+		vector<const uint8_t*> tail(rows, rows + count);
+		for (auto& r : tail) r += x;
+		BoxRowsSSE2(tail.data(), w, count, dst + x, bytes - x);
 	}
 }
-static void ShowToast(const wchar_t*) {
-	g_toastVisible = true;
-	g_toastDeadline = GetTickCount64() + 2000;
-	SetTimer(g_hwnd, TOAST_TIMER_ID, 2000, nullptr);
+// One output pixel at a time: two source pixels' channels interleaved, one madd per pair.
+PX_TARGET("sse2") static void BoxColsSSE2(const uint8_t* row, const BoxTaps& t, uint8_t* dst, int dw) {
+	const __m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < dw; ++i) {
+		const uint8_t* s = row + (size_t)t.first[i] * 4;
+		const int16_t* w = &t.w[t.offset[i]];
+		const int n = t.count[i];
+		__m128i acc = _mm_set1_epi32(8192);
+		int k = 0;
+		for (; k + 1 < n; k += 2) {
+			uint64_t two;
+			memcpy(&two, s + k * 4, 8);
+			__m128i p = _mm_cvtsi32_si128((int)(uint32_t)two);
+			__m128i q = _mm_cvtsi32_si128((int)(uint32_t)(two >> 32));
+			__m128i pq = _mm_unpacklo_epi8(_mm_unpacklo_epi8(p, q), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(pq, _mm_set1_epi32((int)(uint16_t)w[k] | (int)w[k + 1] << 16)));
+		}
+		if (k < n) {
+			uint32_t one;
+			memcpy(&one, s + k * 4, 4);
+			__m128i p = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)one), zero), zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(p, _mm_set1_epi32((int)(uint16_t)w[k])));
+		}
+		acc = _mm_srai_epi32(acc, 14);
+		acc = _mm_packs_epi32(acc, acc);
+		const int v = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		memcpy(dst + i * 4, &v, 4);
+	}
 }
-static void ShowToastOnMonitor(const wchar_t*, const RECT& monRect) {
-	g_toastOneMonitor = true;
-	g_toastMonRect = monRect;
-	g_toastVisible = true;
-	g_toastDeadline = GetTickCount64() + 2000;
-	SetTimer(g_hwnd, TOAST_TIMER_ID, 2000, nullptr);
+#endif
+
+static void BoxKernels(BoxRowsFn& rows, BoxColsFn& cols) {
+	static const std::pair<BoxRowsFn, BoxColsFn> fns = [] {
+		std::pair<BoxRowsFn, BoxColsFn> f{ BoxRowsScalar, BoxColsScalar };
+#if EASY_DRAW_X86
+		bool ssse3 = false;
+		f = { CpuHasSSSE3AndAVX2(ssse3) ? BoxRowsAVX2 : BoxRowsSSE2, BoxColsSSE2 };
+#endif
+		return f;
+	}();
+	rows = fns.first;
+	cols = fns.second;
+}
+// Downscales sw x sh to dw x dh (dw <= sw, dh <= sh); src and dst must not overlap.
+static void ResampleBox(const uint8_t* src, ptrdiff_t srcStride, int sw, int sh, uint8_t* dst, ptrdiff_t dstStride, int dw, int dh) {
+	BoxRowsFn rowsFn;
+	BoxColsFn colsFn;
+	BoxKernels(rowsFn, colsFn);
+	BoxTaps tx, ty;
+	BuildBoxTaps(sw, dw, tx);
+	BuildBoxTaps(sh, dh, ty);
+	vector<uint8_t> row((size_t)sw * 4);
+	vector<const uint8_t*> rows;
+	for (int y = 0; y < dh; ++y) {
+		rows.clear();
+		for (int k = 0; k < ty.count[y]; ++k) rows.push_back(src + (ty.first[y] + k) * srcStride);
+		rowsFn(rows.data(), &ty.w[ty.offset[y]], ty.count[y], row.data(), sw * 4);
+		colsFn(row.data(), tx, dst + y * dstStride, dw);
+	}
 }
 
-static void LoadConfig() {
-	std::ifstream f("config.txt", std::ios::binary);
-	if (!f.is_open()) {
-		auto add = [&](WPARAM k, float r, float g, float b) {
-			Style s;
-			s.color = {r, g, b, 1.f};
-			g_styleKeys[k] = s;
-		};
-		add('R', 1.f, 0.f, 0.f);
-		add('G', 0.f, 0.78f, 0.f);
-		add('B', 0.f, 0.47f, 1.f);
-		add('Y', 1.f, 1.f, 0.f);
-		add('P', 1.f, 105 / 255.f, 180 / 255.f);
-		add('C', 0.f, 1.f, 1.f);
-		add('V', 148 / 255.f, 0.f, 211 / 255.f);
+// ---------- PNG writer (portable, banded parallel deflate) ----------
+// Rows are split into bands that are filtered and deflated on their own threads. A band
+// never refers back into the previous one and ends with an empty stored block (a sync flush,
+// as pigz does), so the compressed bands concatenate into one valid zlib stream; each band
+// becomes its own IDAT chunk and the band Adler-32s are combined instead of recomputed.
+// Nothing in this section touches Win32.
+struct ImageView {
+	const uint8_t* data = nullptr;   // top-down rows
+	ptrdiff_t      stride = 0;
+	int            w = 0, h = 0;
+	int            channels = 3;     // 3 = RGB, 4 = RGBA (straight alpha)
+};
+
+static const uint32_t* Crc32Table() {
+	static const struct Table {
+		uint32_t v[256];
+		Table() {
+			for (uint32_t n = 0; n < 256; ++n) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				v[n] = c;
+			}
+		}
+	} table;
+	return table.v;
+}
+static uint32_t Crc32Update(uint32_t crc, const uint8_t* p, size_t n) {
+	const uint32_t* t = Crc32Table();
+	crc = ~crc;
+	while (n--) crc = t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+static uint32_t Adler32Update(uint32_t adler, const uint8_t* p, size_t n) {
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	while (n) {
+		size_t k = min(n, (size_t)5552);
+		n -= k;
+		while (k--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return a | (b << 16);
+}
+// Adler-32 of A+B from adler(A), adler(B) and len(B).
+static uint32_t Adler32Combine(uint32_t a1, uint32_t a2, size_t len2) {
+	const uint32_t base = 65521;
+	uint32_t rem = (uint32_t)(len2 % base);
+	uint32_t s1 = a1 & 0xFFFF;
+	uint32_t s2 = (uint32_t)(((uint64_t)rem * s1) % base);
+	s1 += (a2 & 0xFFFF) + base - 1;
+	s2 += (a1 >> 16) + (a2 >> 16) + base - rem;
+	if (s1 >= base) s1 -= base;
+	if (s1 >= base) s1 -= base;
+	if (s2 >= 2 * base) s2 -= 2 * base;
+	if (s2 >= base) s2 -= base;
+	return s1 | (s2 << 16);
+}
+
+struct BitWriter {
+	vector<uint8_t>& out;
+	uint64_t acc = 0;
+	int      n = 0;
+	explicit BitWriter(vector<uint8_t>& o) : out(o) {}
+	void Put(uint32_t bits, int count) {
+		acc |= (uint64_t)bits << n;
+		n += count;
+		while (n >= 8) {
+			out.push_back((uint8_t)acc);
+			acc >>= 8;
+			n -= 8;
+		}
+	}
+	// Huffman codes go out MSB-first.
+	void PutCode(uint32_t code, int len) {
+		uint32_t r = 0;
+		for (int i = 0; i < len; ++i) r |= ((code >> i) & 1) << (len - 1 - i);
+		Put(r, len);
+	}
+	void Align() {
+		if (n) Put(0, 8 - n);
+	}
+};
+
+struct DeflateTables {
+	uint16_t lenSym[259];
+	uint8_t  lenExtra[29];
+	uint16_t lenBase[29];
+	uint8_t  distExtra[30];
+	uint16_t distBase[30];
+	DeflateTables() {
+		static const uint16_t lb[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+		static const uint8_t  le[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+		static const uint16_t db[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+		static const uint8_t  de[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+		memcpy(lenBase, lb, sizeof(lb));
+		memcpy(lenExtra, le, sizeof(le));
+		memcpy(distBase, db, sizeof(db));
+		memcpy(distExtra, de, sizeof(de));
+		for (int c = 0; c < 29; ++c)
+			for (int l = lb[c]; l < (c == 28 ? 259 : lb[c + 1]); ++l) lenSym[l] = (uint16_t)c;
+		lenSym[258] = 28;
+	}
+	int DistCode(int d) const {
+		int c = 0;
+		while (c < 29 && distBase[c + 1] <= d) ++c;
+		return c;
+	}
+};
+static const DeflateTables& Deflate() {
+	static const DeflateTables t;
+	return t;
+}
+
+// Length-limited Huffman code lengths (heap build, then the miniz-style Kraft repair).
+static void HuffmanLengths(const uint32_t* freq, int n, int limit, uint8_t* lens) {
+	memset(lens, 0, n);
+	vector<int> syms;
+	for (int i = 0; i < n; ++i) if (freq[i]) syms.push_back(i);
+	if (syms.empty()) return;
+	if (syms.size() == 1) {
+		lens[syms[0]] = 1;
+		return;
+	}
+	std::sort(syms.begin(), syms.end(), [&](int a, int b) { return freq[a] != freq[b] ? freq[a] < freq[b] : a < b; });
+	// Two-queue Huffman over the sorted leaves; parents record tree shape for depths.
+	const int m = (int)syms.size();
+	vector<uint64_t> w(2 * m);
+	vector<int> parent(2 * m, -1);
+	for (int i = 0; i < m; ++i) w[i] = freq[syms[i]];
+	int leaf = 0, node = m, next = m;
+	auto take = [&]() {
+		if (leaf < m && (node >= next || w[leaf] <= w[node])) return leaf++;
+		return node++;
+	};
+	for (; next < 2 * m - 1; ++next) {
+		int a = take(), b = take();
+		w[next] = w[a] + w[b];
+		parent[a] = parent[b] = next;
+	}
+	vector<int> depth(2 * m, 0);
+	int count[64] = {};
+	for (int i = 2 * m - 3; i >= 0; --i) depth[i] = depth[parent[i]] + 1;
+	for (int i = 0; i < m; ++i) ++count[min(depth[i], 63)];
+	for (int l = limit + 1; l < 64; ++l) {
+		count[limit] += count[l];
+		count[l] = 0;
+	}
+	uint32_t total = 0;
+	for (int l = limit; l > 0; --l) total += (uint32_t)count[l] << (limit - l);
+	while (total != (1u << limit)) {
+		--count[limit];
+		for (int l = limit - 1; l > 0; --l) {
+			if (count[l]) {
+				--count[l];
+				count[l + 1] += 2;
+				break;
+			}
+		}
+		--total;
+	}
+	// Most frequent symbols (end of `syms`) get the shortest codes.
+	int s = m - 1;
+	for (int l = 1; l <= limit; ++l)
+		for (int k = 0; k < count[l]; ++k) lens[syms[s--]] = (uint8_t)l;
+}
+static void HuffmanCodes(const uint8_t* lens, int n, uint16_t* codes) {
+	int blCount[16] = {};
+	for (int i = 0; i < n; ++i) ++blCount[lens[i]];
+	blCount[0] = 0;
+	int next[16] = {};
+	for (int b = 1, code = 0; b < 16; ++b) {
+		code = (code + blCount[b - 1]) << 1;
+		next[b] = code;
+	}
+	for (int i = 0; i < n; ++i) codes[i] = lens[i] ? (uint16_t)next[lens[i]]++ : 0;
+}
+
+struct LzToken {
+	uint16_t len;    // 0 = literal
+	uint16_t val;    // literal byte or distance
+};
+
+// Emits one non-final block for `toks` as stored, fixed or dynamic, whichever is smallest.
+static void DeflateEmitBlock(BitWriter& bw, const vector<LzToken>& toks, const uint8_t* raw, size_t rawLen) {
+	const DeflateTables& T = Deflate();
+	uint32_t lf[286] = {}, df[30] = {};
+	for (const LzToken& t : toks) {
+		if (!t.len) ++lf[t.val];
+		else {
+			++lf[257 + T.lenSym[t.len]];
+			++df[T.DistCode(t.val)];
+		}
+	}
+	lf[256] = 1;
+	uint8_t ll[288] = {}, dl[30];
+	HuffmanLengths(lf, 286, 15, ll);
+	HuffmanLengths(df, 30, 15, dl);
+	// Give the distance tree at least two codes; some inflaters reject a one-code tree.
+	int usedD = 0;
+	for (int i = 0; i < 30; ++i) usedD += dl[i] ? 1 : 0;
+	if (usedD < 2) {
+		int want = 2 - usedD;
+		for (int i = 0; i < 30 && want; ++i) if (!dl[i]) {
+			dl[i] = 1;
+			--want;
+		}
+		for (int i = 0; i < 30; ++i) if (dl[i]) dl[i] = 1;
+	}
+	int hlit = 286, hdist = 30;
+	while (hlit > 257 && !ll[hlit - 1]) --hlit;
+	while (hdist > 1 && !dl[hdist - 1]) --hdist;
+	
+	// Code-length alphabet with 16/17/18 run-length codes.
+	vector<uint8_t> seq(ll, ll + hlit);
+	seq.insert(seq.end(), dl, dl + hdist);
+	vector<std::pair<uint8_t, uint8_t>> rle;   // (symbol, extra)
+	for (size_t i = 0; i < seq.size();) {
+		size_t run = 1;
+		while (i + run < seq.size() && seq[i + run] == seq[i]) ++run;
+		if (seq[i] == 0 && run >= 3) {
+			size_t r = min(run, (size_t)138);
+			rle.push_back(r >= 11 ? std::make_pair((uint8_t)18, (uint8_t)(r - 11)) : std::make_pair((uint8_t)17, (uint8_t)(r - 3)));
+			i += r;
+		} else if (seq[i] != 0 && run >= 4) {
+			rle.push_back({ seq[i], 0 });
+			size_t r = min(run - 1, (size_t)6);
+			rle.push_back({ 16, (uint8_t)(r - 3) });
+			i += 1 + r;
+		} else {
+			rle.push_back({ seq[i], 0 });
+			++i;
+		}
+	}
+	uint32_t cf[19] = {};
+	for (auto& e : rle) ++cf[e.first];
+	uint8_t cl[19];
+	HuffmanLengths(cf, 19, 7, cl);
+	static const uint8_t order[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+	int hclen = 19;
+	while (hclen > 4 && !cl[order[hclen - 1]]) --hclen;
+	
+	uint64_t dynBits = 3 + 5 + 5 + 4 + 3 * (uint64_t)hclen, fixBits = 3;
+	for (auto& e : rle) dynBits += cl[e.first] + (e.first == 16 ? 2 : e.first == 17 ? 3 : e.first == 18 ? 7 : 0);
+	for (int s = 0; s < 286; ++s) {
+		if (!lf[s]) continue;
+		uint32_t extra = s > 256 ? T.lenExtra[s - 257] : 0;
+		dynBits += (uint64_t)lf[s] * (ll[s] + extra);
+		fixBits += (uint64_t)lf[s] * ((s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8) + extra);
+	}
+	for (int d = 0; d < 30; ++d) {
+		dynBits += (uint64_t)df[d] * (dl[d] + T.distExtra[d]);
+		fixBits += (uint64_t)df[d] * (5 + T.distExtra[d]);
+	}
+	uint64_t storedBits = (rawLen / 65535 + 1) * 40 + (uint64_t)rawLen * 8 + 7;
+	
+	if (storedBits <= dynBits && storedBits <= fixBits) {
+		size_t off = 0;
+		do {
+			size_t n = min(rawLen - off, (size_t)65535);
+			bw.Put(0, 3);
+			bw.Align();
+			bw.Put((uint32_t)n, 16);
+			bw.Put((uint32_t)~n & 0xFFFF, 16);
+			for (size_t i = 0; i < n; ++i) bw.Put(raw[off + i], 8);
+			off += n;
+		} while (off < rawLen);
+		return;
+	}
+	if (fixBits <= dynBits) {
+		for (int s = 0; s < 288; ++s) ll[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+		for (int d = 0; d < 30; ++d) dl[d] = 5;
+		bw.Put(1 << 1, 3);
+	} else {
+		bw.Put(2 << 1, 3);
+		bw.Put(hlit - 257, 5);
+		bw.Put(hdist - 1, 5);
+		bw.Put(hclen - 4, 4);
+		for (int i = 0; i < hclen; ++i) bw.Put(cl[order[i]], 3);
+		uint16_t cc[19];
+		HuffmanCodes(cl, 19, cc);
+		for (auto& e : rle) {
+			bw.PutCode(cc[e.first], cl[e.first]);
+			if (e.first == 16) bw.Put(e.second, 2);
+			else if (e.first == 17) bw.Put(e.second, 3);
+			else if (e.first == 18) bw.Put(e.second, 7);
+		}
+	}
+	uint16_t lc[288], dc[30];
+	HuffmanCodes(ll, 288, lc);
+	HuffmanCodes(dl, 30, dc);
+	for (const LzToken& t : toks) {
+		if (!t.len) {
+			bw.PutCode(lc[t.val], ll[t.val]);
+			continue;
+		}
+		int ls = T.lenSym[t.len], ds = T.DistCode(t.val);
+		bw.PutCode(lc[257 + ls], ll[257 + ls]);
+		if (T.lenExtra[ls]) bw.Put(t.len - T.lenBase[ls], T.lenExtra[ls]);
+		bw.PutCode(dc[ds], dl[ds]);
+		if (T.distExtra[ds]) bw.Put(t.val - T.distBase[ds], T.distExtra[ds]);
+	}
+	bw.PutCode(lc[256], ll[256]);
+}
+
+// Deflates `p` as a run of non-final blocks followed by a sync flush. Level 0 is Huffman only,
+// 1..9 trade hash-chain depth (and lazy matching from 4 up) for ratio.
+static void DeflateBand(const uint8_t* p, size_t n, int level, vector<uint8_t>& out) {
+	static const struct { int chain, nice; bool lazy; } cfg[10] = {
+		{ 0, 0, false }, { 4, 16, false }, { 8, 32, false }, { 16, 64, false }, { 16, 32, true },
+		{ 32, 64, true }, { 64, 128, true }, { 128, 128, true }, { 512, 258, true }, { 2048, 258, true },
+	};
+	const auto& c = cfg[min(9, max(0, level))];
+	BitWriter bw(out);
+	const size_t kBlockTokens = 1 << 15;
+	vector<LzToken> toks;
+	toks.reserve(kBlockTokens + 2);
+	size_t blockStart = 0;
+	auto flush = [&](size_t end) {
+		DeflateEmitBlock(bw, toks, p + blockStart, end - blockStart);
+		toks.clear();
+		blockStart = end;
+	};
+	
+	if (c.chain == 0) {
+		for (size_t i = 0; i < n; ++i) {
+			toks.push_back({ 0, p[i] });
+			if (toks.size() >= kBlockTokens) flush(i + 1);
+		}
+	} else {
+		const int kHashBits = 15, kWin = 1 << 15;
+		vector<int32_t> head((size_t)1 << kHashBits, -1), prev(kWin, -1);
+		auto hashAt = [&](size_t i) {
+			return (uint32_t)(((p[i] << 16) | (p[i + 1] << 8) | p[i + 2]) * 2654435761u) >> (32 - kHashBits);
+		};
+		auto insert = [&](size_t i) {
+			if (i + 2 >= n) return;
+			uint32_t h = hashAt(i);
+			prev[i & (kWin - 1)] = head[h];
+			head[h] = (int32_t)i;
+		};
+		auto longest = [&](size_t i, int& bestDist) {
+			int best = 0;
+			if (i + 2 >= n) return 0;
+			const int maxLen = (int)min((size_t)258, n - i);
+			int32_t cand = head[hashAt(i)];
+			for (int chain = c.chain; cand >= 0 && chain > 0; --chain) {
+				size_t d = i - (size_t)cand;
+				if (d == 0 || d >= (size_t)kWin) break;
+				const uint8_t* a = p + i;
+				const uint8_t* b = p + cand;
+				if (b[best] == a[best]) {
+					int l = 0;
+					while (l < maxLen && a[l] == b[l]) ++l;
+					if (l > best) {
+						best = l;
+						bestDist = (int)d;
+						if (l >= c.nice || l == maxLen) break;
+					}
+				}
+				int32_t nx = prev[cand & (kWin - 1)];
+				if (nx >= cand) break;
+				cand = nx;
+			}
+			return best >= 3 ? best : 0;
+		};
+		size_t i = 0;
+		while (i < n) {
+			int dist = 0;
+			int len = longest(i, dist);
+			if (len && c.lazy && len < c.nice && i + 1 < n) {
+				insert(i);
+				int dist2 = 0;
+				int len2 = longest(i + 1, dist2);
+				if (len2 > len) {
+					toks.push_back({ 0, p[i] });
+					++i;
+					len = len2;
+					dist = dist2;
+				} else {
+					toks.push_back({ (uint16_t)len, (uint16_t)dist });
+					for (size_t k = i + 1; k < i + len; ++k) insert(k);
+					i += len;
+					if (toks.size() >= kBlockTokens) flush(i);
+					continue;
+				}
+			}
+			if (len) {
+				toks.push_back({ (uint16_t)len, (uint16_t)dist });
+				for (size_t k = i; k < i + len; ++k) insert(k);
+				i += len;
+			} else {
+				toks.push_back({ 0, p[i] });
+				insert(i);
+				++i;
+			}
+			if (toks.size() >= kBlockTokens) flush(i);
+		}
+	}
+	if (!toks.empty() || blockStart < n) flush(n);
+	// Sync flush: empty stored block leaves the band byte-aligned and self-contained.
+	bw.Put(0, 3);
+	bw.Align();
+	bw.Put(0x0000, 16);
+	bw.Put(0xFFFF, 16);
+}
+
+// Applies PNG filter `f` to one row; `up` is a zero row for the first line.
+static uint64_t PngFilterRow(int f, const uint8_t* cur, const uint8_t* up, size_t n, size_t bpp, uint8_t* o) {
+	size_t x = 0;
+	for (; x < bpp && x < n; ++x) {
+		int b = up[x];
+		int pred = f == 2 || f == 4 ? b : f == 3 ? b >> 1 : 0;
+		o[x] = (uint8_t)(cur[x] - pred);
+	}
+	switch (f) {
+	case 0: memcpy(o + x, cur + x, n - x); break;
+	case 1: for (; x < n; ++x) o[x] = (uint8_t)(cur[x] - cur[x - bpp]); break;
+	case 2: for (; x < n; ++x) o[x] = (uint8_t)(cur[x] - up[x]); break;
+	case 3: for (; x < n; ++x) o[x] = (uint8_t)(cur[x] - ((cur[x - bpp] + up[x]) >> 1)); break;
+	case 4:
+		for (; x < n; ++x) {
+			int a = cur[x - bpp], b = up[x], c = up[x - bpp];
+			int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2 * c);
+			o[x] = (uint8_t)(cur[x] - ((pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c)));
+		}
+		break;
+	}
+	uint64_t cost = 0;
+	for (size_t k = 0; k < n; ++k) cost += (uint32_t)std::abs((int)(int8_t)o[k]);
+	return cost;
+}
+// Writes filter bytes plus filtered rows [y0, y1) into `out` (min-sum-of-abs heuristic).
+static void PngFilterRows(const ImageView& img, int y0, int y1, int level, vector<uint8_t>& out) {
+	const size_t bpp = (size_t)img.channels, rowBytes = (size_t)img.w * bpp;
+	out.resize((rowBytes + 1) * (size_t)(y1 - y0));
+	vector<uint8_t> zero(rowBytes, 0), cand(rowBytes);
+	for (int y = y0; y < y1; ++y) {
+		const uint8_t* cur = img.data + y * img.stride;
+		const uint8_t* up = y > 0 ? img.data + (y - 1) * img.stride : zero.data();
+		uint8_t* dst = out.data() + (rowBytes + 1) * (size_t)(y - y0);
+		if (level == 0) {
+			dst[0] = 0;
+			memcpy(dst + 1, cur, rowBytes);
+			continue;
+		}
+		uint64_t bestCost = UINT64_MAX;
+		for (int f = 0; f < 5; ++f) {
+			uint64_t cost = PngFilterRow(f, cur, up, rowBytes, bpp, cand.data());
+			if (cost < bestCost) {
+				bestCost = cost;
+				dst[0] = (uint8_t)f;
+				memcpy(dst + 1, cand.data(), rowBytes);
+			}
+		}
+	}
+}
+
+static void PngPutChunk(vector<uint8_t>& out, const char type[4], const uint8_t* data, size_t n, uint32_t crc) {
+	const uint8_t len[4] = { (uint8_t)(n >> 24), (uint8_t)(n >> 16), (uint8_t)(n >> 8), (uint8_t)n };
+	out.insert(out.end(), len, len + 4);
+	out.insert(out.end(), type, type + 4);
+	if (n) out.insert(out.end(), data, data + n);
+	const uint8_t c[4] = { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+	out.insert(out.end(), c, c + 4);
+}
+static uint32_t PngChunkCrc(const char type[4], const uint8_t* data, size_t n) {
+	return Crc32Update(Crc32Update(0, (const uint8_t*)type, 4), data, n);
+}
+
+// Persistent workers for the deflate bands, one per hardware thread but the caller's. Several
+// encoders may share them; a caller runs its first band itself and then helps with whatever
+// bands are still queued, so it never sleeps while work it waits on sits in the queue.
+struct BandPool {
+	std::mutex                        m;
+	std::condition_variable           cv;
+	std::deque<std::function<void()>> q;
+	vector<std::thread>               threads;
+	bool                              stop = false;
+};
+BandPool g_bandPool;
+
+static void BandWorker() {
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(g_bandPool.m);
+			g_bandPool.cv.wait(lock, [] { return g_bandPool.stop || !g_bandPool.q.empty(); });
+			if (g_bandPool.q.empty()) return;
+			task = std::move(g_bandPool.q.front());
+			g_bandPool.q.pop_front();
+		}
+		task();
+	}
+}
+static void StopBandPool() {
+	{
+		std::lock_guard<std::mutex> lock(g_bandPool.m);
+		g_bandPool.stop = true;
+	}
+	g_bandPool.cv.notify_all();
+	for (auto& t : g_bandPool.threads) t.join();
+	g_bandPool.threads.clear();
+}
+// Runs work(0..n-1) across the pool and returns once all have finished.
+static void RunBands(int n, const std::function<void(int)>& work) {
+	if (n > 1) {
+		std::lock_guard<std::mutex> lock(g_bandPool.m);
+		if (g_bandPool.threads.empty() && !g_bandPool.stop) {
+			const unsigned hw = max(2u, std::thread::hardware_concurrency());
+			for (unsigned i = 1; i < hw; ++i) g_bandPool.threads.emplace_back(BandWorker);
+		}
+	}
+	if (n <= 1 || g_bandPool.threads.empty()) {
+		for (int b = 0; b < n; ++b) work(b);
+		return;
+	}
+	std::mutex doneM;
+	std::condition_variable doneCv;
+	int left = n - 1;
+	{
+		std::lock_guard<std::mutex> lock(g_bandPool.m);
+		for (int b = 1; b < n; ++b)
+			g_bandPool.q.push_back([&, b] {
+				work(b);
+				std::lock_guard<std::mutex> done(doneM);
+				if (--left == 0) doneCv.notify_one();
+			});
+	}
+	g_bandPool.cv.notify_all();
+	work(0);
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::lock_guard<std::mutex> lock(g_bandPool.m);
+			if (g_bandPool.q.empty()) break;
+			task = std::move(g_bandPool.q.front());
+			g_bandPool.q.pop_front();
+		}
+		task();
+	}
+	std::unique_lock<std::mutex> lock(doneM);
+	doneCv.wait(lock, [&] { return left == 0; });
+}
+
+// Encodes `img` into `out`. `threads` <= 0 picks one band per hardware thread.
+static bool EncodePNG(const ImageView& img, int level, vector<uint8_t>& out, int threads = 0) {
+	if (!img.data || img.w <= 0 || img.h <= 0 || (img.channels != 3 && img.channels != 4)) return false;
+	const size_t rowBytes = (size_t)img.w * img.channels + 1;
+	if (threads <= 0) threads = (int)max(1u, std::thread::hardware_concurrency());
+	// Bands below ~256 KB of filtered data are not worth a thread or the sync-flush overhead.
+	int bands = (int)min((size_t)threads, max((size_t)1, rowBytes * img.h / (256 * 1024)));
+	bands = min(bands, img.h);
+	Crc32Table();
+	Deflate();
+	
+	struct Band {
+		vector<uint8_t> z;
+		uint32_t adler = 1, crc = 0;
+		size_t   rawLen = 0;
+	};
+	vector<Band> band((size_t)bands);
+	auto work = [&](int b) {
+		int y0 = (int)((int64_t)img.h * b / bands), y1 = (int)((int64_t)img.h * (b + 1) / bands);
+		vector<uint8_t> raw;
+		PngFilterRows(img, y0, y1, level, raw);
+		Band& B = band[b];
+		B.rawLen = raw.size();
+		B.adler = Adler32Update(1, raw.data(), raw.size());
+		B.z.reserve(level == 0 ? raw.size() + raw.size() / 65535 * 5 + 16 : raw.size() / 2);
+		if (b == 0) {
+			B.z.push_back(0x78);
+			B.z.push_back(level == 0 ? 0x01 : level < 6 ? 0x5E : level == 6 ? 0x9C : 0xDA);
+		}
+		DeflateBand(raw.data(), raw.size(), level, B.z);
+		B.crc = PngChunkCrc("IDAT", B.z.data(), B.z.size());
+	};
+	RunBands(bands, work);
+	
+	static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	out.assign(sig, sig + 8);
+	const uint8_t ihdr[13] = {
+		(uint8_t)(img.w >> 24), (uint8_t)(img.w >> 16), (uint8_t)(img.w >> 8), (uint8_t)img.w,
+		(uint8_t)(img.h >> 24), (uint8_t)(img.h >> 16), (uint8_t)(img.h >> 8), (uint8_t)img.h,
+		8, (uint8_t)(img.channels == 4 ? 6 : 2), 0, 0, 0 };
+	PngPutChunk(out, "IHDR", ihdr, 13, PngChunkCrc("IHDR", ihdr, 13));
+	uint32_t adler = band[0].adler;
+	for (int b = 0; b < bands; ++b) {
+		if (b) adler = Adler32Combine(adler, band[b].adler, band[b].rawLen);
+		PngPutChunk(out, "IDAT", band[b].z.data(), band[b].z.size(), band[b].crc);
+		vector<uint8_t>().swap(band[b].z);
+	}
+	// Final empty fixed block, then the zlib trailer.
+	const uint8_t tail[6] = { 0x03, 0x00, (uint8_t)(adler >> 24), (uint8_t)(adler >> 16), (uint8_t)(adler >> 8), (uint8_t)adler };
+	PngPutChunk(out, "IDAT", tail, 6, PngChunkCrc("IDAT", tail, 6));
+	PngPutChunk(out, "IEND", nullptr, 0, PngChunkCrc("IEND", nullptr, 0));
+	return true;
+}
+
+// ---------- QOI writer (portable) ----------
+// "Quite OK Image" format: lossless, single pass, no entropy coder, so it encodes several
+// times faster than deflate at roughly PNG-fast file sizes. Spec: qoiformat.org.
+static bool EncodeQOI(const ImageView& img, vector<uint8_t>& out) {
+	if (!img.data || img.w <= 0 || img.h <= 0 || (img.channels != 3 && img.channels != 4)) return false;
+	const int ch = img.channels;
+	out.clear();
+	out.reserve((size_t)img.w * img.h * (ch + 1) / 2 + 22);
+	const uint8_t hdr[14] = { 'q', 'o', 'i', 'f',
+		(uint8_t)(img.w >> 24), (uint8_t)(img.w >> 16), (uint8_t)(img.w >> 8), (uint8_t)img.w,
+		(uint8_t)(img.h >> 24), (uint8_t)(img.h >> 16), (uint8_t)(img.h >> 8), (uint8_t)img.h,
+		(uint8_t)ch, 0 };
+	out.insert(out.end(), hdr, hdr + 14);
+	uint32_t index[64] = {};
+	uint32_t prev = 0xFF000000u;   // a<<24 | b<<16 | g<<8 | r
+	int run = 0;
+	for (int y = 0; y < img.h; ++y) {
+		const uint8_t* p = img.data + y * img.stride;
+		for (int x = 0; x < img.w; ++x, p += ch) {
+			uint32_t px = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (ch == 4 ? (uint32_t)p[3] << 24 : 0xFF000000u);
+			if (px == prev) {
+				if (++run == 62) {
+					out.push_back((uint8_t)(0xC0 | (run - 1)));
+					run = 0;
+				}
+				continue;
+			}
+			if (run) {
+				out.push_back((uint8_t)(0xC0 | (run - 1)));
+				run = 0;
+			}
+			const uint8_t r = (uint8_t)px, g = (uint8_t)(px >> 8), b = (uint8_t)(px >> 16), a = (uint8_t)(px >> 24);
+			const int slot = (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+			if (index[slot] == px) out.push_back((uint8_t)slot);
+			else {
+				index[slot] = px;
+				if (a == (uint8_t)(prev >> 24)) {
+					const int dr = (int8_t)(r - (uint8_t)prev), dg = (int8_t)(g - (uint8_t)(prev >> 8)), db = (int8_t)(b - (uint8_t)(prev >> 16));
+					const int drg = dr - dg, dbg = db - dg;
+					if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+						out.push_back((uint8_t)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+					else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+						out.push_back((uint8_t)(0x80 | (dg + 32)));
+						out.push_back((uint8_t)((drg + 8) << 4 | (dbg + 8)));
+					} else {
+						const uint8_t op[4] = { 0xFE, r, g, b };
+						out.insert(out.end(), op, op + 4);
+					}
+				} else {
+					const uint8_t op[5] = { 0xFF, r, g, b, a };
+					out.insert(out.end(), op, op + 5);
+				}
+			}
+			prev = px;
+		}
+	}
+	if (run) out.push_back((uint8_t)(0xC0 | (run - 1)));
+	static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	out.insert(out.end(), end, end + 8);
+	return true;
+}
+// Image size from a QOI header; false if `p` does not start with one.
+static bool QoiSize(const uint8_t* p, size_t n, int& w, int& h) {
+	if (n < 22 || memcmp(p, "qoif", 4) != 0) return false;
+	uint32_t uw = (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 | (uint32_t)p[6] << 8 | p[7];
+	uint32_t uh = (uint32_t)p[8] << 24 | (uint32_t)p[9] << 16 | (uint32_t)p[10] << 8 | p[11];
+	if (!uw || !uh || uw > 32768 || uh > 32768 || (p[12] != 3 && p[12] != 4)) return false;
+	w = (int)uw;
+	h = (int)uh;
+	return true;
+}
+// Decodes to 4 bytes per pixel in the order they were encoded. Stops at the end of the data,
+// so a damaged stream yields a partial image rather than reading past it.
+static bool DecodeQOI(const uint8_t* p, size_t n, int& w, int& h, vector<uint8_t>& out) {
+	if (!QoiSize(p, n, w, h)) return false;
+	out.assign((size_t)w * h * 4, 0);
+	uint8_t index[64][4] = {};
+	uint8_t px[4] = { 0, 0, 0, 255 };
+	size_t i = 14;
+	const size_t end = n - 8;
+	int run = 0;
+	for (size_t o = 0; o < out.size(); o += 4) {
+		if (run) --run;
+		else if (i < end) {
+			const uint8_t b = p[i++];
+			if (b == 0xFE || b == 0xFF) {
+				const size_t k = b == 0xFE ? 3 : 4;
+				if (end - i < k) return false;
+				memcpy(px, p + i, k);
+				i += k;
+			} else if ((b & 0xC0) == 0x00) memcpy(px, index[b], 4);
+			else if ((b & 0xC0) == 0x40) {
+				px[0] += (uint8_t)(((b >> 4) & 3) - 2);
+				px[1] += (uint8_t)(((b >> 2) & 3) - 2);
+				px[2] += (uint8_t)((b & 3) - 2);
+			} else if ((b & 0xC0) == 0x80) {
+				if (i >= end) return false;
+				const uint8_t b2 = p[i++];
+				const int dg = (b & 0x3F) - 32;
+				px[0] += (uint8_t)(dg - 8 + (b2 >> 4));
+				px[1] += (uint8_t)dg;
+				px[2] += (uint8_t)(dg - 8 + (b2 & 0x0F));
+			} else run = b & 0x3F;
+			memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) & 63], px, 4);
+		} else return false;
+		memcpy(out.data() + o, px, 4);
+	}
+	return true;
+}
+
+// ---------- WIC (PNG) ----------
+static bool SaveWICBitmapToPNG(IWICBitmap* bmp, const wchar_t* path) {
+	if (!g_wic || !bmp || !path) return false;
+	IWICStream* stream = nullptr;
+	if (FAILED(g_wic->CreateStream(&stream))) return false;
+	if (FAILED(stream->InitializeFromFilename(path, GENERIC_WRITE))) {
+		SafeRelease(stream);
+		return false;
+	}
+	IWICBitmapEncoder* enc = nullptr;
+	IWICBitmapFrameEncode* frame = nullptr;
+	IPropertyBag2* pb = nullptr;
+	bool ok = false;
+	if (SUCCEEDED(g_wic->CreateEncoder(GUID_ContainerFormatPng, nullptr, &enc)) &&
+		SUCCEEDED(enc->Initialize(stream, WICBitmapEncoderNoCache)) &&
+		SUCCEEDED(enc->CreateNewFrame(&frame, &pb)) &&
+		SUCCEEDED(frame->Initialize(pb))) {
+		UINT w = 0, h = 0;
+		bmp->GetSize(&w, &h);
+		frame->SetSize(w, h);
+		WICPixelFormatGUID pf = GUID_WICPixelFormat32bppPBGRA;
+		frame->SetPixelFormat(&pf);
+		ok = SUCCEEDED(frame->WriteSource(bmp, nullptr)) && SUCCEEDED(frame->Commit()) && SUCCEEDED(enc->Commit());
+	}
+	SafeRelease(pb);
+	SafeRelease(frame);
+	SafeRelease(enc);
+	SafeRelease(stream);
+	return ok;
+}
+static wstring BuildTimestampedPath(const wstring& dir, const wchar_t* tag = L"", const wchar_t* ext = L".png") {
+	SYSTEMTIME st;
+	GetLocalTime(&st);
+	wchar_t base[64];
+	swprintf(base, 64, L"%04d%02d%02d_%02d%02d%02d%ls", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, tag);
+	wstring folder = dir.empty() ? GetDefaultPicturesDir() : dir;
+	if (!folder.empty() && folder.back() != L'\\' && folder.back() != L'/') folder += L'\\';
+	wstring path = folder + base + ext;
+	int suffix = 1;
+	while (GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES) {
+		wchar_t sfx[16];
+		swprintf(sfx, 16, L"-%d", suffix++);
+		path = folder + base + sfx + ext;
+	}
+	return path;
+}
+
+// Encodes raw pixels as PNG into `stream`. Uses its own factory, so it is safe off the UI thread.
+static bool EncodeWICPNG(IWICImagingFactory* fac, IStream* stream, int w, int h, int stride, const BYTE* data, REFWICPixelFormatGUID fmt) {
+	IWICBitmap* wicMem = nullptr;
+	bool ok = SUCCEEDED(fac->CreateBitmapFromMemory((UINT)w, (UINT)h, fmt, (UINT)stride, (UINT)(stride * h), const_cast<BYTE*>(data), &wicMem));
+	if (ok) {
+		IWICBitmapEncoder* enc = nullptr;
+		ok = SUCCEEDED(fac->CreateEncoder(GUID_ContainerFormatPng, nullptr, &enc)) && SUCCEEDED(enc->Initialize(stream, WICBitmapEncoderNoCache));
+		if (ok) {
+			IWICBitmapFrameEncode* frame = nullptr;
+			IPropertyBag2* pb = nullptr;
+			ok = SUCCEEDED(enc->CreateNewFrame(&frame, &pb)) && SUCCEEDED(frame->Initialize(pb));
+			if (ok) {
+				ok = SUCCEEDED(frame->SetSize((UINT)w, (UINT)h));
+				WICPixelFormatGUID pf = GUID_WICPixelFormat32bppPBGRA;
+				ok = ok && SUCCEEDED(frame->SetPixelFormat(&pf));
+				ok = ok && SUCCEEDED(frame->WriteSource(wicMem, nullptr));
+				ok = ok && SUCCEEDED(frame->Commit()) && SUCCEEDED(enc->Commit());
+			}
+			SafeRelease(pb);
+			SafeRelease(frame);
+		}
+		SafeRelease(enc);
+	}
+	SafeRelease(wicMem);
+	return ok;
+}
+static bool SavePNGFromMemoryToFile(const wchar_t* path, int w, int h, int stride, const BYTE* data, REFWICPixelFormatGUID fmt = GUID_WICPixelFormat32bppPBGRA) {
+	IWICImagingFactory* fac = nullptr;
+	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (void * *)&fac)))
+		return false;
+	IWICStream* stream = nullptr;
+	bool ok = SUCCEEDED(fac->CreateStream(&stream)) && SUCCEEDED(stream->InitializeFromFilename(path, GENERIC_WRITE));
+	ok = ok && EncodeWICPNG(fac, stream, w, h, stride, data, fmt);
+	SafeRelease(stream);
+	SafeRelease(fac);
+	return ok;
+}
+// WIC variant of the in-memory encoders below (BGR input). The frame is written as 32bpp
+// and stored deflate can exceed any guess, so it encodes into a growable HGLOBAL stream
+// and copies the result out.
+static bool EncodeWICPNGToMemory(const ImageView& img, vector<uint8_t>& out) {
+	if (img.channels != 3) return false;
+	out.clear();
+	// Callers may already be in an STA (--bench runs on the UI thread); only undo our own init.
+	const HRESULT com = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	IWICImagingFactory* fac = nullptr;
+	bool ok = SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, __uuidof(IWICImagingFactory), (void * *)&fac));
+	if (ok) {
+		IStream* stream = nullptr;
+		HGLOBAL mem = nullptr;
+		ULARGE_INTEGER pos{};
+		ok = SUCCEEDED(CreateStreamOnHGlobal(nullptr, TRUE, &stream));
+		ok = ok && EncodeWICPNG(fac, stream, img.w, img.h, (int)img.stride, img.data, GUID_WICPixelFormat24bppBGR);
+		ok = ok && SUCCEEDED(stream->Seek(LARGE_INTEGER{}, STREAM_SEEK_CUR, &pos));
+		ok = ok && SUCCEEDED(GetHGlobalFromStream(stream, &mem));
+		if (ok) {
+			const void* src = GlobalLock(mem);
+			ok = src != nullptr;
+			if (ok) {
+				out.assign((const uint8_t*)src, (const uint8_t*)src + (size_t)pos.QuadPart);
+				GlobalUnlock(mem);
+			}
+		}
+		SafeRelease(stream);
+	}
+	SafeRelease(fac);
+	if (SUCCEEDED(com)) CoUninitialize();
+	return ok;
+}
+
+static bool EncodePNGDefault(const ImageView& img, vector<uint8_t>& out) {
+	return EncodePNG(img, g_pngLevel, out);
+}
+static bool EncodePNGFast(const ImageView& img, vector<uint8_t>& out) {
+	return EncodePNG(img, 0, out);
+}
+
+// Screenshot output formats, selected by SCREENSHOT_FORMAT. `pack` is the pixel-pipeline
+// op that produces the channel order the encoder expects.
+struct ImageFormat {
+	const char*    name;
+	const wchar_t* ext;
+	unsigned       pack;
+	bool (*encode)(const ImageView& img, vector<uint8_t>& out);
+};
+static const ImageFormat g_imageFormats[] = {
+	{ "png",      L".png", PX_PACK_RGB, EncodePNGDefault },
+	{ "png_fast", L".png", PX_PACK_RGB, EncodePNGFast },
+	{ "qoi",      L".qoi", PX_PACK_RGB, EncodeQOI },
+	{ "png_wic",  L".png", PX_PACK_BGR, EncodeWICPNGToMemory },
+};
+static const ImageFormat& ScreenshotFormat() {
+	return g_imageFormats[g_ssFormat];
+}
+
+static bool WriteBytesToFile(const wchar_t* path, const vector<uint8_t>& bytes) {
+	HANDLE f = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (f == INVALID_HANDLE_VALUE) return false;
+	DWORD written = 0;
+	bool ok = WriteFile(f, bytes.data(), (DWORD)bytes.size(), &written, nullptr) && written == bytes.size();
+	CloseHandle(f);
+	if (!ok) DeleteFileW(path);
+	return ok;
+}
+// Like WriteBytesToFile but never overwrites: on a name clash (two captures in the same
+// second) it appends -1, -2, ... before the extension and updates `path`.
+static bool WriteBytesToNewFile(wstring& path, const vector<uint8_t>& bytes) {
+	const size_t dot = path.find_last_of(L'.');
+	const wstring stem = dot == wstring::npos ? path : path.substr(0, dot);
+	const wstring ext = dot == wstring::npos ? L"" : path.substr(dot);
+	for (int suffix = 1; suffix < 1000; ++suffix) {
+		HANDLE f = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (f == INVALID_HANDLE_VALUE) {
+			if (GetLastError() != ERROR_FILE_EXISTS) return false;
+			path = stem + L"-" + std::to_wstring(suffix) + ext;
+			continue;
+		}
+		DWORD written = 0;
+		bool ok = WriteFile(f, bytes.data(), (DWORD)bytes.size(), &written, nullptr) && written == bytes.size();
+		CloseHandle(f);
+		if (!ok) DeleteFileW(path.c_str());
+		return ok;
+	}
+	return false;
+}
+
+// ---------- Config parsing ----------
+static UINT VKFromToken(const string& t0) {
+	string t = t0;
+	for (char& c : t) c = (char)toupper((unsigned char)c);
+	if (t.size() == 1) {
+		char c = t[0];
+		if (c >= 'A' && c <= 'Z') return 'A' + (c - 'A');
+		if (c >= '0' && c <= '9') return (UINT)c;
+	}
+	if (!t.empty() && t[0] == 'F') {
+		int n = atoi(t.c_str() + 1);
+		if (n >= 1 && n <= 24) return VK_F1 + (n - 1);
+	}
+	if (t == "SPACE") return VK_SPACE;
+	if (t == "TAB") return VK_TAB;
+	if (t == "ESC" || t == "ESCAPE") return VK_ESCAPE;
+	if (t == "DELETE" || t == "DEL") return VK_DELETE;
+	if (t == "BACKSPACE" || t == "BS") return VK_BACK;
+	return 0;
+}
+static void ParseCombo(const string& rhs, Combo& out) {
+	out = Combo{};
+	string t = rhs;
+	for (char& c : t) if (c == '+') c = ' ';
+	std::istringstream ss(t);
+	string a, b;
+	ss >> a;
+	if (!(ss >> b)) {
+		out.ctrl = false;
+		out.vk = VKFromToken(a);
+		return;
+	}
+	for (char& ch : a) ch = (char)toupper((unsigned char)ch);
+	out.ctrl = (a == "CTRL" || a == "CONTROL");
+	out.vk = VKFromToken(b);
+}
+static float ClampRegular(const Style& s, float v) {
+	return min(s.maxW, max(s.minW, v));
+}
+static float ClampHighlightToStyle(const Style& s, float v) {
+	float m = (float)max(1, g_highlightWidthMultiple);
+	return min(s.maxW * m, max(s.minW * m, v));
+}
+static void RecomputeHighlightDefaults() {
+	for (auto& kv : g_styleKeys) {
+		Style& s = kv.second;
+		float m = (float)max(1, g_highlightWidthMultiple);
+		if (s.hiWidth <= 0.f) s.hiWidth = s.width * m;
+		s.hiWidth = min(s.maxW * m, max(s.minW * m, s.hiWidth));
+	}
+}
+static void ShowToast(const wchar_t* text) {
+	g_toastText = text;
+	g_toastVisible = true;
+	g_toastDeadline = GetTickCount64() + 2000;
+	SetTimer(g_hwnd, TOAST_TIMER_ID, 2000, nullptr);
+}
+static void ShowToastOnMonitor(const wchar_t* text, const RECT& monRect) {
+	g_toastText = text;
+	g_toastOneMonitor = true;
+	g_toastMonRect = monRect;
+	g_toastVisible = true;
+	g_toastDeadline = GetTickCount64() + 2000;
+	SetTimer(g_hwnd, TOAST_TIMER_ID, 2000, nullptr);
+}
+
+static void LoadConfig() {
+	std::ifstream f("config.txt", std::ios::binary);
+	if (!f.is_open()) {
+		auto add = [&](WPARAM k, float r, float g, float b) {
+			Style s;
+			s.color = {r, g, b, 1.f};
+			g_styleKeys[k] = s;
+		};
+		add('R', 1.f, 0.f, 0.f);
+		add('G', 0.f, 0.78f, 0.f);
+		add('B', 0.f, 0.47f, 1.f);
+		add('Y', 1.f, 1.f, 0.f);
+		add('P', 1.f, 105 / 255.f, 180 / 255.f);
+		add('C', 0.f, 1.f, 1.f);
+		add('V', 148 / 255.f, 0.f, 211 / 255.f);
 		add('K', 0.f, 0.f, 0.f);
 		add('W', 1.f, 1.f, 1.f);
 		add('O', 1.f, 0.5f, 0.f);
@@ -951,6 +2478,9 @@ static void LoadConfig() {
 		} else if (key == "HIGHLIGHT_WIDTH_MULTIPLE") {
 			int m = 10;
 			if (ss >> m) g_highlightWidthMultiple = max(1, m);
+		} else if (key == "INK_PREDICT_MS") {
+			int ms = 0;
+			if (ss >> ms) g_inkPredictMs = min(50, max(0, ms));
 		} else if (key == "SCREENSHOT") {
 			string k;
 			ss >> k;
@@ -961,6 +2491,96 @@ static void LoadConfig() {
 			std::getline(ss, rhs);
 			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
 			ParseCombo(rhs, g_keyAreaShot);
+		} else if (key == "CLIPBOARD_SCREENSHOT") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyClipShot);
+		} else if (key == "CLIPBOARD_SCREENSHOT_AREA") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyClipAreaShot);
+		} else if (key == "TIMELAPSE") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyTimelapse);
+		} else if (key == "BOARD_SAVE") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyBoardSave);
+		} else if (key == "BOARD_LOAD") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyBoardLoad);
+		} else if (key == "OBJECT_ERASER") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyObjectEraser);
+		} else if (key == "REPLAY") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyReplay);
+		} else if (key == "UNDO_DEPTH") {
+			int n = 0;
+			if (ss >> n) g_undoDepth = max(0, n);
+		} else if (key == "MEMORY_BUDGET_MB") {
+			int mb = 1024;
+			if (ss >> mb) g_memBudgetMB = max(0, mb);
+		} else if (key == "FLATTEN_MB") {
+			int mb = 4;
+			if (ss >> mb) g_flattenMB = max(0, mb);
+		} else if (key == "JOURNAL") {
+			int on = 1;
+			if (ss >> on) g_journal = on != 0;
+		} else if (key == "TIMELAPSE_INTERVAL") {
+			int sec = 30;
+			if (ss >> sec) g_tlIntervalSec = min(3600, max(1, sec));
+		} else if (key == "SCREENSHOT_ANNOTATIONS") {
+			string rhs;
+			std::getline(ss, rhs);
+			if (!rhs.empty() && rhs[0] == ' ') rhs.erase(0, 1);
+			ParseCombo(rhs, g_keyInkShot);
+		} else if (key == "PNG_LEVEL") {
+			int l = 4;
+			if (ss >> l) g_pngLevel = min(9, max(0, l));
+		} else if (key == "SCREENSHOT_FORMAT") {
+			string f;
+			ss >> f;
+			for (auto& ch : f) ch = (char)tolower((unsigned char)ch);
+			for (size_t i = 0; i < sizeof(g_imageFormats) / sizeof(g_imageFormats[0]); ++i)
+				if (f == g_imageFormats[i].name) g_ssFormat = (int)i;
+		} else if (key == "SCREENSHOT_MODE") {
+			string m;
+			ss >> m;
+			for (auto& ch : m) ch = (char)tolower((unsigned char)ch);
+			if (m == "desktop") g_ssMode = SSMODE_DESKTOP;
+			else if (m == "cursor") g_ssMode = SSMODE_CURSOR;
+			else if (m == "monitor") {
+				int n = 1;
+				if (ss >> n) g_ssMonitor = max(1, n);
+				g_ssMode = SSMODE_MONITOR;
+			}
+		} else if (key == "SCREENSHOT_SCALE") {
+			int pct = 100;
+			if (ss >> pct) g_ssScalePct = min(100, max(10, pct));
+		} else if (key == "SCREENSHOT_THUMBNAIL") {
+			int w = 0;
+			if (ss >> w) g_ssThumbWidth = w <= 0 ? 0 : max(32, w);
+		} else if (key == "SCREENSHOT_BUFFERS") {
+			int n = 2;
+			if (ss >> n) g_ssPoolSlots = min(8, max(1, n));
+		} else if (key == "SCREENSHOT_QUEUE_MB") {
+			int n = 512;
+			if (ss >> n) g_ssQueueMB = min(16384, max(64, n));
+		} else if (key == "SCREENSHOT_ENCODERS") {
+			int n = 2;
+			if (ss >> n) g_ssEncoders = min(8, max(1, n));
 		} else if (key == "SCREENSHOT_PATH") {
 			string rest;
 			std::getline(ss, rest);
@@ -1038,46 +2658,62 @@ static void LoadConfig() {
 }
 
 // ---------- Text edit ----------
-static void TextClearHistory() {
-	g_textUndoStack.clear();
-	g_textRedoStack.clear();
+// Live text is only typed or deleted at its end, so the wstring is the buffer (a gap buffer
+// whose gap stays at the end). Undo keeps each edit as an insert or delete span rather than a
+// copy of the whole text, and every edit marks the live layout (DrawLiveText) stale only
+// from the offset it touched.
+static void MarkLiveTextDirty(size_t at) {
+	g_liveTextDirty = min(g_liveTextDirty, at);
+}
+static void ApplyTextOp(const TextOp& op, bool forward) {
+	if (op.insert == forward) g_live.text.insert(op.at, op.span);
+	else g_live.text.erase(op.at, op.span.size());
+	MarkLiveTextDirty(op.at);
+}
+static void TextEdit(TextOp&& op) {
+	ApplyTextOp(op, true);
+	g_textUndoOps.push_back(std::move(op));
+	g_textRedoOps.clear();
 }
-static void TextPushUndo() {
-	g_textUndoStack.push_back(g_live.text);
-	g_textRedoStack.clear();
+static void TextInsert(uint32_t at, wstring span) {
+	TextEdit(TextOp{ true, at, std::move(span) });
+}
+static void TextErase(uint32_t at, uint32_t n) {
+	TextEdit(TextOp{ false, at, g_live.text.substr(at, n) });
+}
+static void TextClearHistory() {
+	g_textUndoOps.clear();
+	g_textRedoOps.clear();
+	MarkLiveTextDirty(0);
 }
 static void TextUndo() {
-	if (!g_textUndoStack.empty()) {
-		g_textRedoStack.push_back(g_live.text);
-		g_live.text = g_textUndoStack.back();
-		g_textUndoStack.pop_back();
-	}
+	if (g_textUndoOps.empty()) return;
+	TextOp op = std::move(g_textUndoOps.back());
+	g_textUndoOps.pop_back();
+	ApplyTextOp(op, false);
+	g_textRedoOps.push_back(std::move(op));
 }
 static void TextRedo() {
-	if (!g_textRedoStack.empty()) {
-		g_textUndoStack.push_back(g_live.text);
-		g_live.text = g_textRedoStack.back();
-		g_textRedoStack.pop_back();
-	}
+	if (g_textRedoOps.empty()) return;
+	TextOp op = std::move(g_textRedoOps.back());
+	g_textRedoOps.pop_back();
+	ApplyTextOp(op, true);
+	g_textUndoOps.push_back(std::move(op));
 }
 
 // ---------- Draw commands ----------
-static void DrawStrokeHighlightUnion(ID2D1DeviceContext* dc, ID2D1Factory1* fac, ID2D1StrokeStyle* roundStroke, const Command& c) {
-	if (c.pts.empty()) return;
-	if (c.pts.size() == 1) {
-		ID2D1SolidColorBrush* br = nullptr;
-		dc->CreateSolidColorBrush(c.style.color, &br);
-		D2D1_ELLIPSE e{ c.pts[0], c.style.width * 0.5f, c.style.width * 0.5f };
-		dc->FillEllipse(e, br);
-		SafeRelease(br);
-		return;
-	}
+// A stroke of two or more points is one geometry: the open polyline, stroked with round caps
+// and joins, or for the highlighter its widened outline, filled. Either is a single primitive,
+// so a translucent stroke covers each pixel once and repaints reuse the cached geometry.
+static ID2D1Geometry* StrokeGeometry(const Command& c) {
+	if (c.geom && c.geomOf == c.pts.data() && c.geomPts == c.pts.size()) return c.geom.get();
+	c.geom.reset();
 	ID2D1PathGeometry* path = nullptr;
-	if (FAILED(fac->CreatePathGeometry(&path))) return;
+	if (FAILED(g_d2dFactory->CreatePathGeometry(&path))) return nullptr;
 	ID2D1GeometrySink* sink = nullptr;
 	if (FAILED(path->Open(&sink))) {
 		SafeRelease(path);
-		return;
+		return nullptr;
 	}
 	sink->SetFillMode(D2D1_FILL_MODE_WINDING);
 	sink->BeginFigure(c.pts[0], D2D1_FIGURE_BEGIN_HOLLOW);
@@ -1085,84 +2721,452 @@ static void DrawStrokeHighlightUnion(ID2D1DeviceContext* dc, ID2D1Factory1* fac,
 	sink->EndFigure(D2D1_FIGURE_END_OPEN);
 	sink->Close();
 	SafeRelease(sink);
-	ID2D1PathGeometry* widened = nullptr;
-	if (SUCCEEDED(fac->CreatePathGeometry(&widened))) {
+	ID2D1Geometry* out = path;
+	if (c.highlight) {
+		ID2D1PathGeometry* widened = nullptr;
 		ID2D1GeometrySink* s2 = nullptr;
-		if (SUCCEEDED(widened->Open(&s2))) {
-			path->Widen(max(1.f, c.style.width), roundStroke, nullptr, D2D1_DEFAULT_FLATTENING_TOLERANCE, s2);
+		if (SUCCEEDED(g_d2dFactory->CreatePathGeometry(&widened)) && SUCCEEDED(widened->Open(&s2))) {
+			path->Widen(max(1.f, c.style.width), g_roundStroke, nullptr, D2D1_DEFAULT_FLATTENING_TOLERANCE, s2);
 			s2->Close();
 			SafeRelease(s2);
-			ID2D1SolidColorBrush* br = nullptr;
-			dc->CreateSolidColorBrush(c.style.color, &br);
-			dc->FillGeometry(widened, br);
-			SafeRelease(br);
 		}
+		SafeRelease(path);
+		if (!widened) return nullptr;
+		out = widened;
 	}
-	SafeRelease(widened);
-	SafeRelease(path);
+	c.geom.reset(out);
+	c.geomOf = c.pts.data();
+	c.geomPts = c.pts.size();
+	return out;
 }
 static void DrawStrokeD2D(const Command& c) {
-	if (c.eraser) {
+	if (c.pts.empty()) return;
+	ID2D1SolidColorBrush* br = nullptr;
+	g_dc->CreateSolidColorBrush(c.eraser ? D2D1::ColorF(0, 0, 0, 0) : c.style.color, &br);
+	if (!br) return;
+	auto oldPB = g_dc->GetPrimitiveBlend();
+	if (c.eraser) g_dc->SetPrimitiveBlend(D2D1_PRIMITIVE_BLEND_COPY);
+	const float w = max(1.f, c.style.width);
+	if (c.pts.size() == 1) g_dc->FillEllipse(D2D1_ELLIPSE{ c.pts[0], w * 0.5f, w * 0.5f }, br);
+	else if (ID2D1Geometry* g = StrokeGeometry(c)) {
+		if (c.highlight) g_dc->FillGeometry(g, br);
+		else g_dc->DrawGeometry(g, br, w, g_roundStroke);
+	}
+	if (c.eraser) g_dc->SetPrimitiveBlend(oldPB);
+	SafeRelease(br);
+}
+// Text is laid out with its baseline-ish bottom at c.pos: the layout origin is pos.y - height.
+static IDWriteTextLayout* CreateTextLayoutFor(const wchar_t* text, UINT32 len, float px, DWRITE_TEXT_METRICS& tm) {
+	IDWriteTextFormat* tf = nullptr;
+	if (FAILED(g_dw->CreateTextFormat(g_fontFamily.c_str(), nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, px, L"", &tf))) return nullptr;
+	IDWriteTextLayout* layout = nullptr;
+	if (FAILED(g_dw->CreateTextLayout(text, len, tf, (FLOAT)g_w, (FLOAT)g_h, &layout))) {
+		SafeRelease(tf);
+		return nullptr;
+	}
+	SafeRelease(tf);
+	if (g_lineSpacingMul > 0.f) {
+		float spacing = px * g_lineSpacingMul;
+		layout->SetLineSpacing(DWRITE_LINE_SPACING_METHOD_UNIFORM, spacing, spacing * 0.8f);
+	}
+	tm = DWRITE_TEXT_METRICS{};
+	layout->GetMetrics(&tm);
+	return layout;
+}
+static float TextSizeOf(const Command& c) {
+	return (c.textSize > 0.f) ? c.textSize : (float)g_fontSizeCur;
+}
+static IDWriteTextLayout* CreateTextLayoutFor(const Command& c, DWRITE_TEXT_METRICS& tm) {
+	return CreateTextLayoutFor(c.text.c_str(), (UINT32)c.text.size(), TextSizeOf(c), tm);
+}
+static void DrawTextD2D(const Command& c) {
+	if (c.text.empty()) return;
+	DWRITE_TEXT_METRICS tm{};
+	IDWriteTextLayout* layout = CreateTextLayoutFor(c, tm);
+	if (!layout) return;
+	ID2D1SolidColorBrush* br = nullptr;
+	g_dc->CreateSolidColorBrush(c.style.color, &br);
+	D2D1_POINT_2F origin{ c.pos.x, c.pos.y - (FLOAT)tm.height };
+	g_dc->DrawTextLayout(origin, layout, br, D2D1_DRAW_TEXT_OPTIONS_NO_SNAP);
+	SafeRelease(br);
+	SafeRelease(layout);
+}
+// The live text keeps one layout per line, stacked bottom-up from g_live.pos the way the
+// single layout of the committed text places its lines. An edit only lays out again the
+// lines from the one it touched (g_liveTextDirty) onward, so typing costs one line.
+struct LiveLine {
+	size_t             start = 0, len = 0;   // in g_live.text, excluding the newline
+	IDWriteTextLayout* layout = nullptr;
+	float              height = 0.f;
+};
+static vector<LiveLine> g_liveLines;
+static float            g_liveLinesPx = 0.f;
+
+static void FreeLiveTextLayout() {
+	for (LiveLine& l : g_liveLines) SafeRelease(l.layout);
+	g_liveLines.clear();
+}
+static void UpdateLiveTextLayout() {
+	const wstring& t = g_live.text;
+	const float px = TextSizeOf(g_live);
+	if (px != g_liveLinesPx) {
+		FreeLiveTextLayout();
+		g_liveLinesPx = px;
+	}
+	size_t keep = 0;
+	while (keep < g_liveLines.size() && g_liveLines[keep].start + g_liveLines[keep].len < g_liveTextDirty) ++keep;
+	g_liveTextDirty = (size_t)-1;
+	if (keep == g_liveLines.size() && keep > 0) return;
+	for (size_t i = keep; i < g_liveLines.size(); ++i) SafeRelease(g_liveLines[i].layout);
+	g_liveLines.resize(keep);
+	size_t pos = keep ? g_liveLines.back().start + g_liveLines.back().len + 1 : 0;
+	for (;;) {
+		size_t end = t.find(L'\n', pos);
+		if (end == wstring::npos) end = t.size();
+		LiveLine l;
+		l.start = pos;
+		l.len = end - pos;
+		DWRITE_TEXT_METRICS tm{};
+		l.layout = CreateTextLayoutFor(t.c_str() + pos, (UINT32)l.len, px, tm);
+		l.height = tm.height;
+		g_liveLines.push_back(l);
+		if (end == t.size()) break;
+		pos = end + 1;
+	}
+}
+static void DrawLiveText() {
+	if (g_live.text.empty()) return;
+	UpdateLiveTextLayout();
+	float y = g_live.pos.y;
+	for (const LiveLine& l : g_liveLines) y -= l.height;
+	ID2D1SolidColorBrush* br = nullptr;
+	g_dc->CreateSolidColorBrush(g_live.style.color, &br);
+	if (!br) return;
+	for (const LiveLine& l : g_liveLines) {
+		if (l.layout) g_dc->DrawTextLayout(D2D1::Point2F(g_live.pos.x, y), l.layout, br, D2D1_DRAW_TEXT_OPTIONS_NO_SNAP);
+		y += l.height;
+	}
+	SafeRelease(br);
+}
+static void DrawRasterD2D(const Command& c) {
+	const RasterLayer* r = c.raster.get();
+	if (!r || r->w <= 0 || r->h <= 0) return;
+	if (!r->bmp) {
+		int w = 0, h = 0;
+		vector<uint8_t> px;
+		if (!DecodeQOI(r->qoi.data(), r->qoi.size(), w, h, px) || w != r->w || h != r->h) return;
+		D2D1_BITMAP_PROPERTIES1 props{};
+		props.pixelFormat = { DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED };
+		props.dpiX = 96.f;
+		props.dpiY = 96.f;
+		if (FAILED(g_dc->CreateBitmap(D2D1_SIZE_U{ (UINT32)w, (UINT32)h }, px.data(), (UINT32)w * 4, &props, &r->bmp))) return;
+	}
+	D2D1_RECT_F dst = D2D1::RectF((FLOAT)r->x, (FLOAT)r->y, (FLOAT)(r->x + r->w), (FLOAT)(r->y + r->h));
+	g_dc->DrawBitmap(r->bmp, dst, 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+}
+// Decoded layers are kept only for rasters on the board. One that leaves it (D, board load, a
+// newer flatten) or was only drawn by the replay decodes again from its QOI when next drawn.
+static void DropRasterBitmaps(const vector<Command>& cmds) {
+	for (const Command& c : cmds)
+		if (c.raster) SafeRelease(c.raster->bmp);
+}
+static void DrawCommandD2D(const Command& c) {
+	if (c.type == CmdType::Stroke) DrawStrokeD2D(c);
+	else if (c.type == CmdType::Text) DrawTextD2D(c);
+	else DrawRasterD2D(c);
+}
+// Runs of consecutive strokes that share a style and blend are drawn as one geometry group
+// with one brush. Only opaque pen strokes and eraser strokes are merged: for them drawing the
+// union once leaves what drawing them one by one would (up to edge antialiasing where they
+// overlap), and nothing else is reordered. Translucent strokes over each other must blend
+// twice, so highlighter strokes are drawn singly.
+static bool Batchable(const Command& c) {
+	return c.type == CmdType::Stroke && !c.highlight && c.pts.size() >= 2 && (c.eraser || c.style.color.a >= 1.f);
+}
+static bool SameBatch(const Command& a, const Command& b) {
+	return a.eraser == b.eraser && a.style.width == b.style.width && (a.eraser || !memcmp(&a.style.color, &b.style.color, sizeof(a.style.color)));
+}
+static void DrawCommandsD2D(const Command* const* cmds, size_t n) {
+	static vector<ID2D1Geometry*> geoms;
+	for (size_t i = 0; i < n;) {
+		const Command& c = *cmds[i];
+		size_t j = i + 1;
+		if (Batchable(c))
+			while (j < n && Batchable(*cmds[j]) && SameBatch(c, *cmds[j])) ++j;
+		if (j - i < 2) {
+			DrawCommandD2D(c);
+			++i;
+			continue;
+		}
+		geoms.clear();
+		for (size_t k = i; k < j; ++k)
+			if (ID2D1Geometry* g = StrokeGeometry(*cmds[k])) geoms.push_back(g);
+		ID2D1GeometryGroup* group = nullptr;
 		ID2D1SolidColorBrush* br = nullptr;
-		g_dc->CreateSolidColorBrush(D2D1::ColorF(0, 0, 0, 0), &br);
-		auto oldPB = g_dc->GetPrimitiveBlend();
-		g_dc->SetPrimitiveBlend(D2D1_PRIMITIVE_BLEND_COPY);
-		float w = max(1.f, c.style.width);
-		if (c.pts.size() == 1) g_dc->FillEllipse(D2D1_ELLIPSE{ c.pts[0], w * 0.5f, w * 0.5f }, br);
-		else for (size_t i = 1; i < c.pts.size(); ++i) g_dc->DrawLine(c.pts[i - 1], c.pts[i], br, w, g_roundStroke);
-		g_dc->SetPrimitiveBlend(oldPB);
+		if (SUCCEEDED(g_d2dFactory->CreateGeometryGroup(D2D1_FILL_MODE_WINDING, geoms.data(), (UINT32)geoms.size(), &group)) &&
+			SUCCEEDED(g_dc->CreateSolidColorBrush(c.eraser ? D2D1::ColorF(0, 0, 0, 0) : c.style.color, &br))) {
+			auto oldPB = g_dc->GetPrimitiveBlend();
+			if (c.eraser) g_dc->SetPrimitiveBlend(D2D1_PRIMITIVE_BLEND_COPY);
+			g_dc->DrawGeometry(group, br, max(1.f, c.style.width), g_roundStroke);
+			if (c.eraser) g_dc->SetPrimitiveBlend(oldPB);
+		} else
+			for (size_t k = i; k < j; ++k) DrawStrokeD2D(*cmds[k]);
 		SafeRelease(br);
-		return;
+		SafeRelease(group);
+		i = j;
 	}
-	if (c.highlight) {
-		DrawStrokeHighlightUnion(g_dc, g_d2dFactory, g_roundStroke, c);
-		return;
+}
+
+// ---------- Spatial index ----------
+// Uniform grid over the overlay listing, per GRID_CELL px cell, the commands whose bounds
+// touch it. Appends are indexed lazily on the next query; any other board change marks the
+// grid stale (NoteBoardOp) and the next query rebuilds it in one pass.
+static const float GRID_CELL = 128.f;
+struct CmdGrid {
+	int cols = 0, rows = 0;
+	size_t indexed = 0;
+	bool valid = false;
+	vector<vector<uint32_t>> cells;
+	vector<uint32_t> stamp;   // per command, dedups multi-cell hits within one query
+	uint32_t epoch = 0;
+};
+CmdGrid g_grid;
+
+static D2D1_RECT_F CommandBounds(const Command& c) {
+	if (c.hasBounds) return c.bounds;
+	D2D1_RECT_F r{ 0, 0, -1, -1 };
+	if (c.type == CmdType::Text) {
+		DWRITE_TEXT_METRICS tm{};
+		if (IDWriteTextLayout* layout = c.text.empty() ? nullptr : CreateTextLayoutFor(c, tm)) {
+			// Pad by half the font size for overhangs (accents, italics) outside the layout box.
+			float pad = 0.5f * ((c.textSize > 0.f) ? c.textSize : (float)g_fontSizeCur);
+			float x = c.pos.x + tm.left, y = c.pos.y - tm.height + tm.top;
+			r = D2D1::RectF(x - pad, y - pad, x + tm.widthIncludingTrailingWhitespace + pad, y + tm.height + pad);
+			SafeRelease(layout);
+		}
+	} else if (c.type == CmdType::Raster) {
+		if (c.raster && c.raster->w > 0 && c.raster->h > 0)
+			r = D2D1::RectF((FLOAT)c.raster->x, (FLOAT)c.raster->y, (FLOAT)(c.raster->x + c.raster->w), (FLOAT)(c.raster->y + c.raster->h));
+	} else if (!c.pts.empty()) {
+		float pad = 0.5f * max(1.f, c.style.width) + 1.f;
+		r = D2D1::RectF(c.pts[0].x, c.pts[0].y, c.pts[0].x, c.pts[0].y);
+		for (const D2D1_POINT_2F& p : c.pts) {
+			r.left = min(r.left, p.x);
+			r.top = min(r.top, p.y);
+			r.right = max(r.right, p.x);
+			r.bottom = max(r.bottom, p.y);
+		}
+		r = D2D1::RectF(r.left - pad, r.top - pad, r.right + pad, r.bottom + pad);
+	}
+	c.bounds = r;
+	c.hasBounds = true;
+	return r;
+}
+static inline bool RectsTouch(const D2D1_RECT_F& a, const D2D1_RECT_F& b) {
+	return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+}
+static void GridCellRange(const D2D1_RECT_F& r, int& c0, int& r0, int& c1, int& r1) {
+	c0 = min(g_grid.cols - 1, max(0, (int)std::floor(r.left / GRID_CELL)));
+	r0 = min(g_grid.rows - 1, max(0, (int)std::floor(r.top / GRID_CELL)));
+	c1 = min(g_grid.cols - 1, max(0, (int)std::floor(r.right / GRID_CELL)));
+	r1 = min(g_grid.rows - 1, max(0, (int)std::floor(r.bottom / GRID_CELL)));
+}
+static void GridSync() {
+	int cols = max(1, (int)std::ceil(g_w / GRID_CELL)), rows = max(1, (int)std::ceil(g_h / GRID_CELL));
+	if (!g_grid.valid || g_grid.cols != cols || g_grid.rows != rows || g_grid.indexed > g_cmds.size()) {
+		g_grid.cols = cols;
+		g_grid.rows = rows;
+		g_grid.cells.assign((size_t)cols * rows, vector<uint32_t>());
+		g_grid.indexed = 0;
+		g_grid.valid = true;
+	}
+	for (; g_grid.indexed < g_cmds.size(); ++g_grid.indexed) {
+		D2D1_RECT_F b = CommandBounds(g_cmds[g_grid.indexed]);
+		if (b.right < b.left) continue;
+		int c0, r0, c1, r1;
+		GridCellRange(b, c0, r0, c1, r1);
+		for (int y = r0; y <= r1; ++y)
+			for (int x = c0; x <= c1; ++x) g_grid.cells[(size_t)y * cols + x].push_back((uint32_t)g_grid.indexed);
+	}
+	g_grid.stamp.resize(g_cmds.size());
+}
+// Commands whose bounds touch `r`, in drawing order.
+static void GridQuery(const D2D1_RECT_F& r, vector<uint32_t>& out) {
+	out.clear();
+	GridSync();
+	if (++g_grid.epoch == 0) {
+		std::fill(g_grid.stamp.begin(), g_grid.stamp.end(), 0);
+		g_grid.epoch = 1;
+	}
+	int c0, r0, c1, r1;
+	GridCellRange(r, c0, r0, c1, r1);
+	for (int y = r0; y <= r1; ++y)
+		for (int x = c0; x <= c1; ++x)
+			for (uint32_t i : g_grid.cells[(size_t)y * g_grid.cols + x]) {
+				if (g_grid.stamp[i] == g_grid.epoch) continue;
+				g_grid.stamp[i] = g_grid.epoch;
+				if (RectsTouch(CommandBounds(g_cmds[i]), r)) out.push_back(i);
+			}
+	std::sort(out.begin(), out.end());
+}
+// ---------- Cached content ----------
+// The committed board is cached in CONTENT_TILE px tiles. A tile is allocated when ink first
+// reaches it and released once nothing but erasers touches it, so GPU memory follows the inked
+// area instead of the virtual desktop, and composition only draws allocated tiles. Tiles sit
+// at whole-pixel offsets, so a command drawn into several of them rasterizes exactly as it
+// would in one bitmap.
+static D2D1_RECT_F TileRect(size_t i) {
+	const float x = (float)((int)(i % g_tilesX) * CONTENT_TILE), y = (float)((int)(i / g_tilesX) * CONTENT_TILE);
+	return D2D1::RectF(x, y, x + CONTENT_TILE, y + CONTENT_TILE);
+}
+// Tile columns [x0, x1) and rows [y0, y1) touched by `r`; false if none.
+static bool TileRange(const D2D1_RECT_F& r, int& x0, int& y0, int& x1, int& y1) {
+	if (r.right < r.left || r.bottom < r.top) return false;
+	x0 = max(0, (int)std::floor(r.left / CONTENT_TILE));
+	y0 = max(0, (int)std::floor(r.top / CONTENT_TILE));
+	x1 = min(g_tilesX, (int)std::floor(r.right / CONTENT_TILE) + 1);
+	y1 = min(g_tilesY, (int)std::floor(r.bottom / CONTENT_TILE) + 1);
+	return x0 < x1 && y0 < y1;
+}
+static bool HasInk(const vector<const Command*>& cmds) {
+	for (const Command* c : cmds)
+		if (!c->eraser) return true;
+	return false;
+}
+// Buckets `cmds` by the tiles their bounds touch, keeping their order within each tile.
+static void BinByTile(const vector<const Command*>& cmds, vector<vector<const Command*>>& bins) {
+	bins.resize(g_tiles.size());
+	for (auto& b : bins) b.clear();
+	int x0, y0, x1, y1;
+	for (const Command* c : cmds)
+		if (TileRange(CommandBounds(*c), x0, y0, x1, y1))
+			for (int ty = y0; ty < y1; ++ty)
+				for (int tx = x0; tx < x1; ++tx) bins[(size_t)ty * g_tilesX + tx].push_back(c);
+}
+static void FreeTile(size_t i) {
+	if (!g_tiles[i]) return;
+	SafeRelease(g_tiles[i]);
+	--g_tileCount;
+}
+// Draws `cmds` in order into tile i, allocating it (transparent) if needed. With `clip` only
+// that part of the tile is cleared and redrawn.
+static void DrawIntoTile(size_t i, const vector<const Command*>& cmds, const D2D1_RECT_F* clip, bool clear) {
+	bool fresh = false;
+	if (!g_tiles[i]) {
+		D2D1_BITMAP_PROPERTIES1 props{};
+		props.pixelFormat = {DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED};
+		props.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET;
+		props.dpiX = 96.f;
+		props.dpiY = 96.f;
+		if (FAILED(g_dc->CreateBitmap(D2D1_SIZE_U{ (UINT32)CONTENT_TILE, (UINT32)CONTENT_TILE }, nullptr, 0, &props, &g_tiles[i]))) return;
+		++g_tileCount;
+		fresh = true;
 	}
-	if (c.pts.empty()) return;
-	ID2D1SolidColorBrush* br = nullptr;
-	g_dc->CreateSolidColorBrush(c.style.color, &br);
-	float w = max(1.f, c.style.width);
-	for (size_t i = 1; i < c.pts.size(); ++i) g_dc->DrawLine(c.pts[i - 1], c.pts[i], br, w, g_roundStroke);
-	if (c.pts.size() == 1) g_dc->FillEllipse(D2D1_ELLIPSE{ c.pts[0], w * 0.5f, w * 0.5f }, br);
-	SafeRelease(br);
+	const D2D1_RECT_F tr = TileRect(i);
+	D2D1_MATRIX_3X2_F oldXf;
+	g_dc->GetTransform(&oldXf);
+	g_dc->SetTarget(g_tiles[i]);
+	g_dc->BeginDraw();
+	if (fresh) g_dc->Clear(D2D1::ColorF(0, 0, 0, 0));
+	g_dc->SetTransform(D2D1::Matrix3x2F::Translation(-tr.left, -tr.top));
+	if (clip) g_dc->PushAxisAlignedClip(*clip, D2D1_ANTIALIAS_MODE_ALIASED);
+	if (clear) g_dc->Clear(D2D1::ColorF(0, 0, 0, 0));
+	DrawCommandsD2D(cmds.data(), cmds.size());
+	if (clip) g_dc->PopAxisAlignedClip();
+	g_dc->EndDraw();
+	g_dc->SetTransform(oldXf);
 }
-static void DrawTextD2D(const Command& c) {
-	if (c.text.empty()) return;
-	float px = (c.textSize > 0.f) ? c.textSize : (float)g_fontSizeCur;
-	IDWriteTextFormat* tf = nullptr;
-	if (FAILED(g_dw->CreateTextFormat(g_fontFamily.c_str(), nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, px, L"", &tf))) return;
-	IDWriteTextLayout* layout = nullptr;
-	if (FAILED(g_dw->CreateTextLayout(c.text.c_str(), (UINT32)c.text.size(), tf, (FLOAT)g_w, (FLOAT)g_h, &layout))) {
-		SafeRelease(tf);
-		return;
+
+static void RepaintContent() {
+	if (!g_dc || g_tiles.empty()) return;
+	++g_contentVersion;
+	static vector<const Command*> list;
+	static vector<vector<const Command*>> bins;
+	list.clear();
+	if (g_replaying) {
+		for (uint32_t id : g_rpBoard) list.push_back(&g_histCmds[id]);
+	} else {
+		for (const auto& c : g_cmds) list.push_back(&c);
 	}
-	if (g_lineSpacingMul > 0.f) {
-		float spacing = px * g_lineSpacingMul;
-		layout->SetLineSpacing(DWRITE_LINE_SPACING_METHOD_UNIFORM, spacing, spacing * 0.8f);
+	BinByTile(list, bins);
+	for (size_t i = 0; i < g_tiles.size(); ++i) {
+		if (HasInk(bins[i])) DrawIntoTile(i, bins[i], nullptr, true);
+		else FreeTile(i);
 	}
-	DWRITE_TEXT_METRICS tm{};
-	layout->GetMetrics(&tm);
-	ID2D1SolidColorBrush* br = nullptr;
-	g_dc->CreateSolidColorBrush(c.style.color, &br);
-	D2D1_POINT_2F origin{ c.pos.x, c.pos.y - (FLOAT)tm.height };
-	g_dc->DrawTextLayout(origin, layout, br, D2D1_DRAW_TEXT_OPTIONS_NO_SNAP);
-	SafeRelease(br);
-	SafeRelease(layout);
-	SafeRelease(tf);
+	g_dc->SetTarget(nullptr);
+}
+// Draws `list` on top of the current content, in order (same result as a repaint).
+static void AppendCommands(const vector<const Command*>& list) {
+	if (!g_dc || g_tiles.empty() || list.empty()) return;
+	++g_contentVersion;
+	static vector<vector<const Command*>> bins;
+	BinByTile(list, bins);
+	for (size_t i = 0; i < g_tiles.size(); ++i)
+		if (g_tiles[i] ? !bins[i].empty() : HasInk(bins[i])) DrawIntoTile(i, bins[i], nullptr, false);
+	g_dc->SetTarget(nullptr);
+}
+static void AppendContent(const uint32_t* ids, size_t n) {
+	static vector<const Command*> list;
+	list.clear();
+	for (size_t i = 0; i < n; ++i) list.push_back(&g_histCmds[ids[i]]);
+	AppendCommands(list);
+}
+// Draws the allocated tiles over `area` of the current target, offset so board pixel
+// (area.left, area.top) lands at the target's origin.
+static void DrawContentTiles(const D2D1_RECT_F& area) {
+	int x0, y0, x1, y1;
+	if (!TileRange(area, x0, y0, x1, y1)) return;
+	for (int ty = y0; ty < y1; ++ty)
+		for (int tx = x0; tx < x1; ++tx) {
+			const size_t i = (size_t)ty * g_tilesX + tx;
+			if (!g_tiles[i]) continue;
+			D2D1_RECT_F r = TileRect(i);
+			r = D2D1::RectF(r.left - area.left, r.top - area.top, r.right - area.left, r.bottom - area.top);
+			g_dc->DrawBitmap(g_tiles[i], r, 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+		}
 }
 
-// ---------- Cached content ----------
-static void RepaintContent() {
-	if (!g_contentBmp) return;
-	g_dc->SetTarget(g_contentBmp);
-	g_dc->BeginDraw();
-	g_dc->Clear(D2D1::ColorF(0, 0, 0, 0));
-	for (const auto& c : g_cmds) {
-		if (c.type == CmdType::Stroke) DrawStrokeD2D(c);
-		else DrawTextD2D(c);
+// Repaints just `r` of the content layer: in each tile it touches, the commands touching it
+// are redrawn in order under an aliased clip (Clear honours the clip). Commands hidden by an
+// object-erase gesture are skipped. A tile left with no ink at all is released.
+static void RepaintContentRect(D2D1_RECT_F r) {
+	if (!g_dc || g_tiles.empty()) return;
+	if (g_replaying) {
+		RepaintContent();
+		return;
 	}
-	g_dc->EndDraw();
-	g_dc->SetTarget(g_target);
+	if (r.right < r.left || r.bottom < r.top) return;
+	r = D2D1::RectF(std::floor(r.left), std::floor(r.top), std::ceil(r.right), std::ceil(r.bottom));
+	static vector<uint32_t> hits, rest;
+	static vector<const Command*> list;
+	static vector<vector<const Command*>> bins;
+	GridQuery(r, hits);
+	list.clear();
+	for (uint32_t i : hits)
+		if (!(g_objErasing && g_objHidden[i])) list.push_back(&g_cmds[i]);
+	BinByTile(list, bins);
+	++g_contentVersion;
+	int x0, y0, x1, y1;
+	if (TileRange(r, x0, y0, x1, y1))
+		for (int ty = y0; ty < y1; ++ty)
+			for (int tx = x0; tx < x1; ++tx) {
+				const size_t i = (size_t)ty * g_tilesX + tx;
+				if (!HasInk(bins[i])) {
+					if (!g_tiles[i]) continue;
+					bool ink = false;
+					GridQuery(TileRect(i), rest);
+					for (uint32_t k : rest)
+						if (!g_cmds[k].eraser && !(g_objErasing && g_objHidden[k])) ink = true;
+					if (!ink) {
+						FreeTile(i);
+						continue;
+					}
+				}
+				const D2D1_RECT_F tr = TileRect(i);
+				const D2D1_RECT_F clip = D2D1::RectF(max(r.left, tr.left), max(r.top, tr.top), min(r.right, tr.right), min(r.bottom, tr.bottom));
+				DrawIntoTile(i, bins[i], &clip, true);
+			}
+	g_dc->SetTarget(nullptr);
 }
 
 // ---------- UI overlays ----------
@@ -1198,6 +3202,13 @@ static void DrawSizeIndicator() {
 		D2D1_RECT_F rc = D2D1::RectF(g_mousePos.x - r, g_mousePos.y - r, g_mousePos.x + r, g_mousePos.y + r);
 		g_dc->DrawRectangle(rc, brH, 3.f);
 		g_dc->DrawRectangle(rc, brC, 2.f);
+		if (g_objectEraser) {
+			D2D1_POINT_2F tl{ rc.left, rc.top }, br{ rc.right, rc.bottom }, tr{ rc.right, rc.top }, bl{ rc.left, rc.bottom };
+			g_dc->DrawLine(tl, br, brH, 3.f);
+			g_dc->DrawLine(tr, bl, brH, 3.f);
+			g_dc->DrawLine(tl, br, brC, 2.f);
+			g_dc->DrawLine(tr, bl, brC, 2.f);
+		}
 	} else {
 		const Style& s = ActiveStyle();
 		float dRequested = g_highlight ? s.hiWidth : s.width;
@@ -1272,6 +3283,40 @@ static void DrawMagnifierWindowOutline() {
 	SafeRelease(b2);
 }
 
+static void DrawReplayBar() {
+	if (!g_replaying) return;
+	wchar_t msg[96];
+	swprintf(msg, 96, L"Replay  %u:%02u / %u:%02u  %gx%ls", g_rpClock / 60000, g_rpClock / 1000 % 60, g_rpDuration / 60000, g_rpDuration / 1000 % 60, g_rpSpeed, g_rpPlaying ? L"" : L"  (paused)");
+	IDWriteTextFormat* tf = nullptr;
+	if (FAILED(g_dw->CreateTextFormat(g_fontFamily.c_str(), nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, (float)g_ssTextSize, L"", &tf))) return;
+	IDWriteTextLayout* layout = nullptr;
+	if (FAILED(g_dw->CreateTextLayout(msg, (UINT32)wcslen(msg), tf, (FLOAT)g_w, (FLOAT)g_h, &layout))) {
+		SafeRelease(tf);
+		return;
+	}
+	DWRITE_TEXT_METRICS tm{};
+	layout->GetMetrics(&tm);
+	ID2D1SolidColorBrush* brBg = nullptr;
+	ID2D1SolidColorBrush* brTx = nullptr;
+	g_dc->CreateSolidColorBrush(D2D1::ColorF(g_ssBgR / 255.f, g_ssBgG / 255.f, g_ssBgB / 255.f, g_ssBgA / 255.f), &brBg);
+	g_dc->CreateSolidColorBrush(D2D1::ColorF(g_ssTextR / 255.f, g_ssTextG / 255.f, g_ssTextB / 255.f, g_ssTextA / 255.f), &brTx);
+	
+	const float margin = 24.f, barW = max(tm.width, 360.f), frac = g_rpDuration ? (float)g_rpClock / g_rpDuration : 1.f;
+	for (const RECT& r : g_monitors) {
+		float x = (float)(r.left - g_vx) + ((float)(r.right - r.left) - barW) / 2.f;
+		float y = (float)(r.top - g_vy) + margin;
+		g_dc->FillRectangle(D2D1::RectF(x - 16.f, y - 8.f, x + barW + 16.f, y + tm.height + 20.f), brBg);
+		g_dc->DrawTextLayout(D2D1::Point2F(x, y), layout, brTx, D2D1_DRAW_TEXT_OPTIONS_NO_SNAP);
+		float by = y + tm.height + 6.f;
+		g_dc->DrawRectangle(D2D1::RectF(x, by, x + barW, by + 6.f), brTx, 1.f);
+		g_dc->FillRectangle(D2D1::RectF(x, by, x + barW * frac, by + 6.f), brTx);
+	}
+	SafeRelease(brBg);
+	SafeRelease(brTx);
+	SafeRelease(layout);
+	SafeRelease(tf);
+}
+
 static void DrawToastIfNeeded() {
 	if (!g_toastVisible) return;
 	if (GetTickCount64() > g_toastDeadline) {
@@ -1279,7 +3324,7 @@ static void DrawToastIfNeeded() {
 		return;
 	}
 	
-	const wchar_t* msg = L"Screenshot Saved.";
+	const wchar_t* msg = g_toastText.c_str();
 	float px = (float)g_ssTextSize;
 	IDWriteTextFormat* tf = nullptr;
 	if (FAILED(g_dw->CreateTextFormat(g_fontFamily.c_str(), nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, px, L"", &tf))) return;
@@ -1296,21 +3341,13 @@ static void DrawToastIfNeeded() {
 	g_dc->CreateSolidColorBrush(D2D1::ColorF(g_ssBgR / 255.f, g_ssBgG / 255.f, g_ssBgB / 255.f, g_ssBgA / 255.f), &brBg);
 	g_dc->CreateSolidColorBrush(D2D1::ColorF(g_ssTextR / 255.f, g_ssTextG / 255.f, g_ssTextB / 255.f, g_ssTextA / 255.f), &brTx);
 	
-	vector<RECT> mons;
-	if (g_toastOneMonitor) {
-		mons.push_back(g_toastMonRect);
-	} else {
-		struct MonCtx {
-			static BOOL CALLBACK CB(HMONITOR, HDC, LPRECT prc, LPARAM lp) {
-				((vector<RECT>*)lp)->push_back(*prc);
-				return TRUE;
-			}
-		};
-		EnumDisplayMonitors(nullptr, nullptr, MonCtx::CB, (LPARAM)&mons);
-	}
+	// Runs inside RenderFrameAround, so mid-stroke too: no enumeration or vector growth here.
+	const RECT* mons = g_toastOneMonitor ? &g_toastMonRect : g_monitors.data();
+	const size_t monCount = g_toastOneMonitor ? 1 : g_monitors.size();
 	float margin = 24.f;
 	
-	for (const RECT& r : mons) {
+	for (size_t i = 0; i < monCount; ++i) {
+		const RECT& r = mons[i];
 		float monW = (float)(r.right - r.left), monH = (float)(r.bottom - r.top);
 		float baseX = (float)(r.left - g_vx);
 		float baseY = (float)(r.top  - g_vy);
@@ -1327,35 +3364,1062 @@ static void DrawToastIfNeeded() {
 	SafeRelease(tf);
 }
 
+// ---------- Ink prediction ----------
+// With INK_PREDICT_MS set, the live stroke gets a short predicted tail: a least-squares
+// velocity over the last INK_FIT_MS of timestamped pointer samples, extrapolated from the
+// newest sample. The tail lives only on the live layer and is recomputed on every sample.
+// Highlighter and eraser strokes are not predicted (a wrong guess would show through).
+struct InkSample {
+	D2D1_POINT_2F p;
+	double        t;   // ms
+};
+static const double       INK_FIT_MS = 40.0;
+static InkSample          g_inkSamples[16];   // oldest first; a plain array so a sample never allocates
+static size_t             g_inkCount = 0;
+static bool               g_inkTailOn = false;
+static D2D1_POINT_2F      g_inkTail{ 0, 0 };
+
+// Predicts where the pen will be `horizonMs` after the newest sample. Refuses when there are
+// too few samples, the pen is nearly still, or the fitted direction disagrees with the last
+// segment (a corner), where extrapolating overshoots most.
+static bool PredictInk(const InkSample* s, size_t n, double horizonMs, D2D1_POINT_2F& out) {
+	if (n < 3 || horizonMs <= 0.0) return false;
+	const InkSample& last = s[n - 1];
+	size_t first = n - 1;
+	while (first > 0 && last.t - s[first - 1].t <= INK_FIT_MS) --first;
+	if (n - first < 3) return false;
+	double mt = 0, mx = 0, my = 0;
+	for (size_t i = first; i < n; ++i) {
+		mt += s[i].t;
+		mx += s[i].p.x;
+		my += s[i].p.y;
+	}
+	const double k = (double)(n - first);
+	mt /= k;
+	mx /= k;
+	my /= k;
+	double stt = 0, stx = 0, sty = 0;
+	for (size_t i = first; i < n; ++i) {
+		const double dt = s[i].t - mt;
+		stt += dt * dt;
+		stx += dt * (s[i].p.x - mx);
+		sty += dt * (s[i].p.y - my);
+	}
+	if (stt < 1e-6) return false;
+	const double vx = stx / stt, vy = sty / stt;   // px per ms
+	const double speed = std::sqrt(vx * vx + vy * vy);
+	if (speed < 0.05) return false;
+	const double lx = last.p.x - s[n - 2].p.x, ly = last.p.y - s[n - 2].p.y;
+	const double ll = std::sqrt(lx * lx + ly * ly);
+	if (ll > 0.5 && (lx * vx + ly * vy) < 0.5 * ll * speed) return false;
+	out = D2D1::Point2F((float)(last.p.x + vx * horizonMs), (float)(last.p.y + vy * horizonMs));
+	return true;
+}
+static double PointerTimeMs(const POINTER_INFO& pi) {
+	static const double perMs = [] {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		return f.QuadPart / 1000.0;
+	}();
+	return pi.PerformanceCount ? pi.PerformanceCount / perMs : (double)pi.dwTime;
+}
+// Records the timestamp of the sample about to be passed to AddToStroke.
+static void NoteInkSample(D2D1_POINT_2F p, double tMs) {
+	if (g_inkPredictMs <= 0 || !g_drawing) return;
+	if (g_inkCount && tMs <= g_inkSamples[g_inkCount - 1].t) return;
+	size_t drop = g_inkCount == 16 ? 1 : 0;
+	while (g_inkCount - drop > 2 && tMs - g_inkSamples[drop].t > INK_FIT_MS) ++drop;
+	if (drop) {
+		std::copy(g_inkSamples + drop, g_inkSamples + g_inkCount, g_inkSamples);
+		g_inkCount -= drop;
+	}
+	g_inkSamples[g_inkCount++] = { p, tMs };
+}
+// Refreshes the tail after the live stroke gained the point `p`.
+static void UpdateInkTail(D2D1_POINT_2F p) {
+	g_inkTailOn = false;
+	if (g_inkPredictMs <= 0 || g_live.eraser || g_live.highlight || !g_inkCount) return;
+	const InkSample& last = g_inkSamples[g_inkCount - 1];
+	if (last.p.x != p.x || last.p.y != p.y) return;
+	g_inkTailOn = PredictInk(g_inkSamples, g_inkCount, g_inkPredictMs, g_inkTail);
+}
+static void ClearInkPrediction() {
+	g_inkCount = 0;
+	g_inkTailOn = false;
+}
+static void DrawInkTail(ID2D1Brush* br) {
+	if (!g_inkTailOn || g_live.pts.empty()) return;
+	g_dc->DrawLine(g_live.pts.back(), g_inkTail, br, max(1.f, g_live.style.width), g_roundStroke);
+}
+
+// ---------- Live stroke ----------
+// The stroke being drawn is not rebuilt as one geometry per point: its points are cut into
+// closed path geometries of LIVE_BLOCK segments, built once each, and the segments past the
+// last block are drawn as lines. Its brush is kept and recoloured. A point then costs one
+// DrawLine per surface and no D2D object; one geometry is built every LIVE_BLOCK points.
+// A translucent highlighter is drawn opaque into a layer at its alpha, so overlapping blocks
+// and lines still cover each pixel once, as the committed stroke's single geometry does.
+static const size_t LIVE_BLOCK = 64;
+static vector<ComRef<ID2D1Geometry>> g_liveBlocks;   // block k: pts[k * LIVE_BLOCK, (k + 1) * LIVE_BLOCK]
+static ID2D1SolidColorBrush*         g_liveBrush = nullptr;
+static D2D1_RECT_F                   g_liveBounds{ 0, 0, -1, -1 };   // of the points seen so far
+static size_t                        g_liveBoundsPts = 0;
+
+// Call when a new live stroke starts.
+static void ResetLiveStroke() {
+	g_liveBlocks.clear();
+	g_liveBoundsPts = 0;
+}
+static void FreeLiveStroke() {
+	ResetLiveStroke();
+	vector<ComRef<ID2D1Geometry>>().swap(g_liveBlocks);
+	SafeRelease(g_liveBrush);
+}
+static void BuildLiveBlocks() {
+	const PointBuf& pts = g_live.pts;
+	while ((g_liveBlocks.size() + 1) * LIVE_BLOCK < pts.size()) {
+		const size_t first = g_liveBlocks.size() * LIVE_BLOCK;
+		ID2D1PathGeometry* path = nullptr;
+		ID2D1GeometrySink* sink = nullptr;
+		if (FAILED(g_d2dFactory->CreatePathGeometry(&path)) || FAILED(path->Open(&sink))) {
+			SafeRelease(path);
+			return;
+		}
+		sink->BeginFigure(pts[first], D2D1_FIGURE_BEGIN_HOLLOW);
+		sink->AddLines(&pts[first + 1], (UINT32)LIVE_BLOCK);
+		sink->EndFigure(D2D1_FIGURE_END_OPEN);
+		sink->Close();
+		SafeRelease(sink);
+		g_liveBlocks.emplace_back();
+		g_liveBlocks.back().reset(path);
+	}
+}
+static void DrawLiveStroke(bool withTail) {
+	const PointBuf& pts = g_live.pts;
+	if (pts.empty()) return;
+	if (!g_liveBrush && FAILED(g_dc->CreateSolidColorBrush(D2D1::ColorF(0, 0, 0, 0), &g_liveBrush))) return;
+	const float w = max(1.f, g_live.style.width);
+	D2D1_COLOR_F color = g_live.eraser ? D2D1::ColorF(0, 0, 0, 0) : g_live.style.color;
+	const bool layer = g_live.highlight && color.a < 1.f;
+	if (layer) {
+		for (; g_liveBoundsPts < pts.size(); ++g_liveBoundsPts) {
+			const D2D1_POINT_2F p = pts[g_liveBoundsPts];
+			if (!g_liveBoundsPts) g_liveBounds = D2D1::RectF(p.x, p.y, p.x, p.y);
+			else g_liveBounds = D2D1::RectF(min(g_liveBounds.left, p.x), min(g_liveBounds.top, p.y), max(g_liveBounds.right, p.x), max(g_liveBounds.bottom, p.y));
+		}
+		const float pad = 0.5f * w + 1.f;
+		const D2D1_RECT_F b = D2D1::RectF(g_liveBounds.left - pad, g_liveBounds.top - pad, g_liveBounds.right + pad, g_liveBounds.bottom + pad);
+		g_dc->PushLayer(D2D1::LayerParameters1(b, nullptr, D2D1_ANTIALIAS_MODE_PER_PRIMITIVE, D2D1::IdentityMatrix(), color.a), nullptr);
+		color.a = 1.f;
+	}
+	g_liveBrush->SetColor(color);
+	auto oldPB = g_dc->GetPrimitiveBlend();
+	if (g_live.eraser) g_dc->SetPrimitiveBlend(D2D1_PRIMITIVE_BLEND_COPY);
+	if (pts.size() == 1) g_dc->FillEllipse(D2D1_ELLIPSE{ pts[0], w * 0.5f, w * 0.5f }, g_liveBrush);
+	else {
+		BuildLiveBlocks();
+		for (const auto& g : g_liveBlocks) g_dc->DrawGeometry(g.get(), g_liveBrush, w, g_roundStroke);
+		for (size_t i = g_liveBlocks.size() * LIVE_BLOCK + 1; i < pts.size(); ++i) g_dc->DrawLine(pts[i - 1], pts[i], g_liveBrush, w, g_roundStroke);
+	}
+	if (withTail) DrawInkTail(g_liveBrush);
+	if (g_live.eraser) g_dc->SetPrimitiveBlend(oldPB);
+	if (layer) g_dc->PopLayer();
+}
+
 // ---------- Frame ----------
-static void RenderFrame(bool withLive) {
-	if (!g_dc || !g_target) return;
-	g_dc->SetTarget(g_target);
+// Every surface draws the whole overlay under a translation to its monitor and lets the
+// target clip the rest. A surface whose chain still has a frame queued is skipped rather than
+// waited on, so a slow monitor never stalls a fast one; it is marked stale and picked up by
+// PACE_TIMER_ID. RenderFrameAround redraws only the surfaces an update touches.
+static D2D1_POINT_2F g_shownMouse{ 0, 0 };   // where the size indicator was last drawn
+static bool          g_lastWithLive = false;
+
+static void RenderSurface(Surface& s, bool withLive) {
+	if (s.wait && WaitForSingleObject(s.wait, 0) != WAIT_OBJECT_0) {
+		s.stale = true;
+		SetTimer(g_hwnd, PACE_TIMER_ID, USER_TIMER_MINIMUM, nullptr);
+		return;
+	}
+	s.stale = false;
+	g_dc->SetTarget(s.target);
 	g_dc->BeginDraw();
 	g_dc->Clear(D2D1::ColorF(0, 0, 0, 0));
-	if (g_contentBmp) {
-		D2D1_RECT_F dst = D2D1::RectF(0, 0, (FLOAT)g_w, (FLOAT)g_h);
-		g_dc->DrawBitmap(g_contentBmp, dst, 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
-	}
+	DrawContentTiles(D2D1::RectF((FLOAT)s.rc.left, (FLOAT)s.rc.top, (FLOAT)s.rc.right, (FLOAT)s.rc.bottom));
+	g_dc->SetTransform(D2D1::Matrix3x2F::Translation(-(FLOAT)s.rc.left, -(FLOAT)s.rc.top));
 	if (withLive) {
-		if (g_drawing && g_live.type == CmdType::Stroke) DrawStrokeD2D(g_live);
-		if (g_textMode) {
-			Command t = g_live;
-			t.type = CmdType::Text;
-			DrawTextD2D(t);
-		}
+		if (g_drawing && g_live.type == CmdType::Stroke) DrawLiveStroke(true);
+		if (g_textMode) DrawLiveText();
 	}
 	DrawSizeIndicator();
 	DrawMagnifySelectionOutline();
 	DrawAreaShotSelectionOutline();
 	DrawMagnifierWindowOutline();
+	DrawReplayBar();
 	DrawToastIfNeeded();
+	g_dc->SetTransform(D2D1::Matrix3x2F::Identity());
 	g_dc->EndDraw();
-	g_swap->Present(0, 0);
+	g_dc->SetTarget(nullptr);
+	s.swap->Present(0, 0);
+}
+static void RenderFrame(bool withLive) {
+	if (!g_dc || g_surfaces.empty()) return;
+	g_lastWithLive = withLive;
+	g_shownMouse = g_mousePos;
+	for (Surface& s : g_surfaces) RenderSurface(s, withLive);
+}
+// Redraws the surfaces touching `area` or the size indicator's old and new position; the
+// others keep their last frame, which is still correct. Stale surfaces are always redrawn.
+static void RenderFrameAround(bool withLive, D2D1_RECT_F area) {
+	if (!g_dc || g_surfaces.empty()) return;
+	const Style& st = ActiveStyle();
+	const float reach = max(max(st.width, st.hiWidth), (float)max(g_eraserSize, g_fontSizeCur)) + 4.f;
+	const D2D1_POINT_2F m[2] = { g_shownMouse, g_mousePos };
+	for (const D2D1_POINT_2F& p : m) {
+		const D2D1_RECT_F r = D2D1::RectF(p.x - reach, p.y - reach, p.x + reach, p.y + reach);
+		if (area.right < area.left) area = r;
+		else area = D2D1::RectF(min(area.left, r.left), min(area.top, r.top), max(area.right, r.right), max(area.bottom, r.bottom));
+	}
+	g_lastWithLive = withLive;
+	g_shownMouse = g_mousePos;
+	for (Surface& s : g_surfaces) {
+		const D2D1_RECT_F sr = D2D1::RectF((FLOAT)s.rc.left, (FLOAT)s.rc.top, (FLOAT)s.rc.right, (FLOAT)s.rc.bottom);
+		if (s.stale || RectsTouch(sr, area)) RenderSurface(s, withLive);
+	}
+}
+static void RenderStaleSurfaces() {
+	if (!g_dc) return;
+	for (Surface& s : g_surfaces)
+		if (s.stale) RenderSurface(s, g_lastWithLive);
+}
+
+// ---------- Board files (binary sessions) ----------
+// A board is g_cmds on disk. Layout, little endian:
+//   "EDB1", u32 version, varint style count, styles (color RGBA + width, 5 x f32),
+//   varint command count, then per command u8 flags, varint style index and either
+//     stroke: varint point count, first point and deltas as zigzag varints in 1/16 px, or
+//     text:   f32 size, f32 x, f32 y, varint byte count, UTF-8, or
+//     raster: varint x, varint y, varint byte count, QOI image (version 2, see Flattening).
+// Only color and width are stored per style (the rest never affects how ink draws), so a
+// board with thousands of strokes usually has a handful of styles. Saving streams through
+// a 64 KB buffer into a temp file that replaces the target; loading parses a read-only
+// view of the file straight into commands.
+static const char     BOARD_MAGIC[4] = { 'E', 'D', 'B', '1' };
+static const uint32_t BOARD_VERSION = 2;   // reads 1 as well
+static const float    BOARD_QUANT = 16.f;
+enum : uint8_t { BOARD_TEXT = 1, BOARD_ERASER = 2, BOARD_HIGHLIGHT = 4, BOARD_RASTER = 8 };
+
+// Streams to `file` through a 64 KB buffer, or with no file collects everything in `buf`.
+struct BoardWriter {
+	HANDLE file;
+	vector<uint8_t> buf;
+	size_t used = 0;
+	uint64_t total = 0;
+	bool ok = true;
+	explicit BoardWriter(HANDLE f = INVALID_HANDLE_VALUE) : file(f), buf(f == INVALID_HANDLE_VALUE ? 256 : 64 * 1024) {}
+	void Flush() {
+		if (file == INVALID_HANDLE_VALUE) return;
+		if (used && ok) {
+			DWORD wr = 0;
+			ok = WriteFile(file, buf.data(), (DWORD)used, &wr, nullptr) && wr == used;
+			total += used;
+		}
+		used = 0;
+	}
+	void Room(size_t n) {
+		if (buf.size() - used >= n) return;
+		Flush();
+		if (buf.size() - used < n) buf.resize(max(buf.size() * 2, used + n));
+	}
+	void Bytes(const void* p, size_t n) {
+		const uint8_t* s = (const uint8_t*)p;
+		while (n) {
+			Room(1);
+			size_t k = min(n, buf.size() - used);
+			memcpy(buf.data() + used, s, k);
+			used += k;
+			s += k;
+			n -= k;
+		}
+	}
+	void Varint(uint64_t v) {
+		Room(10);
+		while (v >= 0x80) {
+			buf[used++] = (uint8_t)(v | 0x80);
+			v >>= 7;
+		}
+		buf[used++] = (uint8_t)v;
+	}
+	void Zigzag(int32_t v) { Varint(((uint32_t)v << 1) ^ (uint32_t)(v >> 31)); }
+	void F32(float f) { Bytes(&f, 4); }
+	void U8(uint8_t b) { Bytes(&b, 1); }
+};
+struct BoardReader {
+	const uint8_t* p;
+	const uint8_t* end;
+	bool ok = true;
+	size_t Left() const { return (size_t)(end - p); }
+	uint64_t Varint() {
+		uint64_t v = 0;
+		for (int shift = 0; shift < 64 && p < end; shift += 7) {
+			uint8_t b = *p++;
+			v |= (uint64_t)(b & 0x7F) << shift;
+			if (!(b & 0x80)) return v;
+		}
+		ok = false;
+		return 0;
+	}
+	int32_t Zigzag() {
+		uint32_t u = (uint32_t)Varint();
+		return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+	}
+	float F32() {
+		float f = 0.f;
+		if (Left() < 4) {
+			ok = false;
+			return f;
+		}
+		memcpy(&f, p, 4);
+		p += 4;
+		return f;
+	}
+	uint8_t U8() {
+		if (!Left()) {
+			ok = false;
+			return 0;
+		}
+		return *p++;
+	}
+};
+static int32_t BoardQuantize(float v) { return (int32_t)std::lround(v * BOARD_QUANT); }
+static string BoardStyleKey(const Style& s) {
+	const float key[5] = { s.color.r, s.color.g, s.color.b, s.color.a, s.width };
+	return string((const char*)key, sizeof(key));
+}
+static void BoardPutStyle(BoardWriter& w, const Style& s) {
+	w.F32(s.color.r);
+	w.F32(s.color.g);
+	w.F32(s.color.b);
+	w.F32(s.color.a);
+	w.F32(s.width);
+}
+static Style BoardGetStyle(BoardReader& r) {
+	Style s;
+	s.color.r = r.F32();
+	s.color.g = r.F32();
+	s.color.b = r.F32();
+	s.color.a = r.F32();
+	s.width = r.F32();
+	return s;
+}
+// One command after its style has been interned; `utf8` is scratch space reused across calls.
+static void BoardPutCommand(BoardWriter& w, const Command& c, uint32_t style, string& utf8) {
+	w.U8((c.type == CmdType::Text ? BOARD_TEXT : c.type == CmdType::Raster ? BOARD_RASTER : 0) | (c.eraser ? BOARD_ERASER : 0) | (c.highlight ? BOARD_HIGHLIGHT : 0));
+	w.Varint(style);
+	if (c.type == CmdType::Raster) {
+		const RasterLayer* r = c.raster.get();
+		w.Varint(r ? (uint32_t)r->x : 0);
+		w.Varint(r ? (uint32_t)r->y : 0);
+		w.Varint(r ? r->qoi.size() : 0);
+		if (r) w.Bytes(r->qoi.data(), r->qoi.size());
+		return;
+	}
+	if (c.type == CmdType::Text) {
+		w.F32(c.textSize);
+		w.F32(c.pos.x);
+		w.F32(c.pos.y);
+		int n = c.text.empty() ? 0 : WideCharToMultiByte(CP_UTF8, 0, c.text.c_str(), (int)c.text.size(), nullptr, 0, nullptr, nullptr);
+		utf8.resize((size_t)n);
+		if (n) WideCharToMultiByte(CP_UTF8, 0, c.text.c_str(), (int)c.text.size(), &utf8[0], n, nullptr, nullptr);
+		w.Varint((uint64_t)n);
+		w.Bytes(utf8.data(), utf8.size());
+		return;
+	}
+	w.Varint(c.pts.size());
+	int32_t px = 0, py = 0;
+	for (const D2D1_POINT_2F& pt : c.pts) {
+		int32_t qx = BoardQuantize(pt.x), qy = BoardQuantize(pt.y);
+		w.Zigzag(qx - px);
+		w.Zigzag(qy - py);
+		px = qx;
+		py = qy;
+	}
+}
+// Counts are checked against the bytes left so a damaged file cannot trigger huge reserves.
+static bool BoardGetCommand(BoardReader& r, const vector<Style>& styles, Command& c) {
+	uint8_t flags = r.U8();
+	uint64_t si = r.Varint();
+	if (!r.ok || si >= styles.size()) return false;
+	c.style = styles[(size_t)si];
+	c.eraser = (flags & BOARD_ERASER) != 0;
+	c.highlight = (flags & BOARD_HIGHLIGHT) != 0;
+	if (flags & BOARD_RASTER) {
+		c.type = CmdType::Raster;
+		auto layer = std::make_shared<RasterLayer>();
+		uint64_t x = r.Varint(), y = r.Varint(), n = r.Varint();
+		if (!r.ok || x > 65535 || y > 65535 || n > r.Left()) return false;
+		if (n && !QoiSize(r.p, (size_t)n, layer->w, layer->h)) return false;
+		layer->x = (int)x;
+		layer->y = (int)y;
+		layer->qoi.assign(r.p, r.p + n);
+		r.p += n;
+		c.raster = std::move(layer);
+		return true;
+	}
+	if (flags & BOARD_TEXT) {
+		c.type = CmdType::Text;
+		c.textSize = r.F32();
+		c.pos.x = r.F32();
+		c.pos.y = r.F32();
+		uint64_t n = r.Varint();
+		if (!r.ok || n > r.Left()) return false;
+		if (n) {
+			int wn = MultiByteToWideChar(CP_UTF8, 0, (const char*)r.p, (int)n, nullptr, 0);
+			c.text.resize((size_t)wn);
+			if (wn) MultiByteToWideChar(CP_UTF8, 0, (const char*)r.p, (int)n, &c.text[0], wn);
+		}
+		r.p += n;
+		return true;
+	}
+	c.type = CmdType::Stroke;
+	uint64_t n = r.Varint();
+	if (!r.ok || n > r.Left() / 2) return false;
+	c.pts.resize((size_t)n);
+	uint32_t qx = 0, qy = 0;   // wraps instead of overflowing on damaged input
+	for (D2D1_POINT_2F& pt : c.pts) {
+		qx += (uint32_t)r.Zigzag();
+		qy += (uint32_t)r.Zigzag();
+		pt.x = (int32_t)qx / BOARD_QUANT;
+		pt.y = (int32_t)qy / BOARD_QUANT;
+	}
+	c.pts.shrink_to_fit();   // resize takes at least 64 points from the arena
+	return r.ok;
+}
+
+static bool SaveBoard(const vector<Command>& cmds, const wstring& path, uint64_t* bytesOut = nullptr) {
+	// Intern styles first so the table can precede the commands in a single pass over the file.
+	map<string, uint32_t> ids;
+	vector<uint32_t> styleOf(cmds.size());
+	vector<const Style*> styles;
+	for (size_t i = 0; i < cmds.size(); ++i) {
+		auto it = ids.emplace(BoardStyleKey(cmds[i].style), (uint32_t)ids.size()).first;
+		if (it->second == styles.size()) styles.push_back(&cmds[i].style);
+		styleOf[i] = it->second;
+	}
+	
+	wstring tmp = path + L".tmp";
+	HANDLE f = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE) return false;
+	BoardWriter w(f);
+	w.Bytes(BOARD_MAGIC, 4);
+	w.Bytes(&BOARD_VERSION, 4);
+	w.Varint(styles.size());
+	for (const Style* s : styles) BoardPutStyle(w, *s);
+	w.Varint(cmds.size());
+	string utf8;
+	for (size_t i = 0; i < cmds.size() && w.ok; ++i) BoardPutCommand(w, cmds[i], styleOf[i], utf8);
+	w.Flush();
+	bool ok = w.ok;
+	CloseHandle(f);
+	if (ok) ok = MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+	if (!ok) DeleteFileW(tmp.c_str());
+	if (ok && bytesOut) *bytesOut = w.total;
+	return ok;
+}
+
+static bool ParseBoard(const uint8_t* data, size_t size, vector<Command>& out) {
+	BoardReader r{ data, data + size };
+	uint32_t version = 0;
+	if (size < 8 || memcmp(data, BOARD_MAGIC, 4) != 0) return false;
+	memcpy(&version, data + 4, 4);
+	if (version < 1 || version > BOARD_VERSION) return false;
+	r.p += 8;
+	
+	uint64_t nStyles = r.Varint();
+	if (!r.ok || nStyles > r.Left() / 20) return false;
+	vector<Style> styles((size_t)nStyles);
+	for (Style& s : styles) s = BoardGetStyle(r);
+	uint64_t nCmds = r.Varint();
+	if (!r.ok || nCmds > r.Left() / 2) return false;
+	vector<Command> cmds((size_t)nCmds);
+	for (Command& c : cmds)
+		if (!BoardGetCommand(r, styles, c)) return false;
+	out.swap(cmds);
+	return true;
+}
+// Runs `parse` over a read-only view of the whole file.
+static bool MapFileRead(const wchar_t* path, const std::function<bool(const uint8_t*, size_t)>& parse) {
+	HANDLE f = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size{};
+	bool ok = false;
+	if (GetFileSizeEx(f, &size) && size.QuadPart > 0) {
+		HANDLE map = CreateFileMappingW(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (map) {
+			if (const uint8_t* view = (const uint8_t*)MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0)) {
+				ok = parse(view, (size_t)size.QuadPart);
+				UnmapViewOfFile(view);
+			}
+			CloseHandle(map);
+		}
+	}
+	CloseHandle(f);
+	return ok;
+}
+static bool LoadBoard(const wstring& path, vector<Command>& out) {
+	return MapFileRead(path.c_str(), [&](const uint8_t* p, size_t n) { return ParseBoard(p, n, out); });
+}
+
+// ---------- Crash journal ----------
+// Every change to g_cmds is appended to journal.edj (next to config.txt) as a record:
+// varint length, payload (u8 op + board-encoded data), CRC-32 of the payload. The UI
+// thread only encodes records into g_jrPending; a background thread appends them every
+// 250 ms and flushes to disk at most once a second. Replay rebuilds g_cmds (not the undo
+// history) and stops at the first torn or damaged record. Once the file outgrows the board
+// it describes by 2x + 1 MB it is rewritten as a plain list of adds, so replay time follows
+// the board size rather than the session length. A clean exit deletes the journal. If a
+// rewrite or an append fails, the file is deleted rather than left describing another base
+// board, and the next change writes it afresh.
+static const wchar_t JOURNAL_PATH[] = L"journal.edj";
+static const char    JOURNAL_MAGIC[4] = { 'E', 'D', 'J', '1' };
+enum : uint8_t { JR_STYLE = 1, JR_ADD, JR_POP, JR_CLEAR, JR_ERASE, JR_INSERT };
+
+std::thread             g_jrThread;
+std::mutex              g_jrMutex;
+std::condition_variable g_jrCv;
+vector<uint8_t>         g_jrPending, g_jrRewrite;   // guarded by g_jrMutex
+bool                    g_jrStop = false;
+std::atomic<bool>       g_jrLost{ false };   // set by the worker after dropping the file
+// UI thread only
+map<string, uint32_t>   g_jrStyles;
+BoardWriter             g_jrRec;
+string                  g_jrUtf8;
+vector<uint8_t>         g_jrScratch;
+uint64_t                g_jrBytes = 0, g_jrBaseBytes = 0;
+
+static void JournalFrame(vector<uint8_t>& out) {
+	size_t n = g_jrRec.used;
+	for (size_t v = n;; v >>= 7) {
+		if (v < 0x80) {
+			out.push_back((uint8_t)v);
+			break;
+		}
+		out.push_back((uint8_t)(v | 0x80));
+	}
+	out.insert(out.end(), g_jrRec.buf.begin(), g_jrRec.buf.begin() + n);
+	uint32_t crc = Crc32Update(0, g_jrRec.buf.data(), n);
+	out.insert(out.end(), (const uint8_t*)&crc, (const uint8_t*)&crc + 4);
+}
+// JR_INSERT carries the position `at` before the command; JR_ADD appends.
+static void JournalRecord(vector<uint8_t>& out, uint8_t op, const Command* c, uint32_t at = 0) {
+	uint32_t style = 0;
+	if (c) {
+		auto it = g_jrStyles.emplace(BoardStyleKey(c->style), (uint32_t)g_jrStyles.size());
+		if (it.second) {
+			g_jrRec.used = 0;
+			g_jrRec.U8(JR_STYLE);
+			BoardPutStyle(g_jrRec, c->style);
+			JournalFrame(out);
+		}
+		style = it.first->second;
+	}
+	g_jrRec.used = 0;
+	g_jrRec.U8(op);
+	if (op == JR_INSERT) g_jrRec.Varint(at);
+	if (c) BoardPutCommand(g_jrRec, *c, style, g_jrUtf8);
+	JournalFrame(out);
+}
+// Replaces the journal with the current board; pending records are already part of it.
+static void JournalCompact() {
+	if (!g_jrThread.joinable()) return;
+	g_jrStyles.clear();
+	vector<uint8_t> img(JOURNAL_MAGIC, JOURNAL_MAGIC + 4);
+	for (const Command& c : g_cmds) JournalRecord(img, JR_ADD, &c);
+	g_jrBaseBytes = g_jrBytes = img.size();
+	{
+		std::lock_guard<std::mutex> lk(g_jrMutex);
+		g_jrPending.clear();
+		g_jrRewrite.swap(img);
+	}
+	g_jrCv.notify_one();
+}
+static void JournalSubmit() {
+	g_jrBytes += g_jrScratch.size();
+	{
+		std::lock_guard<std::mutex> lk(g_jrMutex);
+		g_jrPending.insert(g_jrPending.end(), g_jrScratch.begin(), g_jrScratch.end());
+	}
+	if (g_jrLost.exchange(false) || g_jrBytes > 2 * g_jrBaseBytes + (1u << 20)) JournalCompact();
+}
+static void JournalOp(uint8_t op, const Command* c = nullptr, uint32_t at = 0) {
+	if (!g_jrThread.joinable()) return;
+	g_jrScratch.clear();
+	JournalRecord(g_jrScratch, op, c, at);
+	JournalSubmit();
+}
+// Positions are ascending and delta-coded.
+static void JournalErase(const vector<uint32_t>& at) {
+	if (!g_jrThread.joinable()) return;
+	g_jrScratch.clear();
+	g_jrRec.used = 0;
+	g_jrRec.U8(JR_ERASE);
+	g_jrRec.Varint(at.size());
+	uint32_t prev = 0;
+	for (uint32_t p : at) {
+		g_jrRec.Varint(p - prev);
+		prev = p;
+	}
+	JournalFrame(g_jrScratch);
+	JournalSubmit();
+}
+static void JournalWorker() {
+	HANDLE f = INVALID_HANDLE_VALUE;
+	bool dirty = false;
+	ULONGLONG lastSync = 0;
+	vector<uint8_t> batch, image;
+	// Records only make sense on top of the image they follow, so once the file cannot be
+	// trusted it goes, and batches are dropped until the UI thread sends a new image.
+	auto lose = [&] {
+		if (f != INVALID_HANDLE_VALUE) CloseHandle(f);
+		f = INVALID_HANDLE_VALUE;
+		DeleteFileW(JOURNAL_PATH);
+		dirty = false;
+		g_jrLost = true;
+	};
+	std::unique_lock<std::mutex> lk(g_jrMutex);
+	for (;;) {
+		g_jrCv.wait_for(lk, std::chrono::milliseconds(250), [] { return g_jrStop || !g_jrRewrite.empty(); });
+		batch.swap(g_jrPending);
+		image.swap(g_jrRewrite);
+		bool stop = g_jrStop;
+		lk.unlock();
+		
+		if (!image.empty()) {
+			if (f != INVALID_HANDLE_VALUE) CloseHandle(f);
+			f = INVALID_HANDLE_VALUE;
+			wstring tmp = wstring(JOURNAL_PATH) + L".tmp";
+			if (WriteBytesToFile(tmp.c_str(), image)) {
+				if (MoveFileExW(tmp.c_str(), JOURNAL_PATH, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+					f = CreateFileW(JOURNAL_PATH, FILE_APPEND_DATA, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				else DeleteFileW(tmp.c_str());
+			}
+			if (f == INVALID_HANDLE_VALUE) lose();
+			image.clear();
+		}
+		if (!batch.empty() && f != INVALID_HANDLE_VALUE) {
+			DWORD wr = 0;
+			if (!WriteFile(f, batch.data(), (DWORD)batch.size(), &wr, nullptr) || wr != batch.size()) lose();
+			else dirty = true;
+		}
+		batch.clear();
+		if (dirty && (stop || GetTickCount64() - lastSync >= 1000)) {
+			FlushFileBuffers(f);
+			lastSync = GetTickCount64();
+			dirty = false;
+		}
+		if (stop) break;
+		lk.lock();
+	}
+	if (f != INVALID_HANDLE_VALUE) CloseHandle(f);
+}
+static void StartJournal() {
+	if (!g_journal || g_jrThread.joinable()) return;
+	g_jrStop = false;
+	g_jrThread = std::thread(JournalWorker);
+	JournalCompact();
+}
+// `discard` deletes the file: after a clean exit there is nothing to recover.
+static void StopJournal(bool discard) {
+	if (!g_jrThread.joinable()) return;
+	{
+		std::lock_guard<std::mutex> lk(g_jrMutex);
+		g_jrStop = true;
+	}
+	g_jrCv.notify_one();
+	g_jrThread.join();
+	if (discard) DeleteFileW(JOURNAL_PATH);
+}
+
+static bool ParseJournal(const uint8_t* data, size_t size, vector<Command>& out) {
+	if (size < 4 || memcmp(data, JOURNAL_MAGIC, 4) != 0) return false;
+	BoardReader r{ data + 4, data + size };
+	vector<Style> styles;
+	vector<Command> cmds;
+	while (r.Left()) {
+		uint64_t n = r.Varint();
+		if (!r.ok || n == 0 || n > r.Left() || r.Left() - n < 4) break;
+		const uint8_t* rec = r.p;
+		uint32_t crc;
+		memcpy(&crc, rec + n, 4);
+		if (Crc32Update(0, rec, (size_t)n) != crc) break;
+		BoardReader q{ rec + 1, rec + n };
+		if (rec[0] == JR_STYLE) styles.push_back(BoardGetStyle(q));
+		else if (rec[0] == JR_ADD) {
+			Command c;
+			if (!BoardGetCommand(q, styles, c)) break;
+			cmds.push_back(std::move(c));
+		} else if (rec[0] == JR_POP) {
+			if (!cmds.empty()) cmds.pop_back();
+		} else if (rec[0] == JR_CLEAR) cmds.clear();
+		else if (rec[0] == JR_ERASE) {
+			uint64_t n = q.Varint();
+			if (!q.ok || n > cmds.size()) break;
+			vector<uint32_t> at((size_t)n);
+			uint64_t pos = 0;
+			for (size_t i = 0; i < at.size() && q.ok; ++i) {
+				uint64_t d = q.Varint();
+				pos += d;
+				if ((i && !d) || pos >= cmds.size()) q.ok = false;
+				at[i] = (uint32_t)pos;
+			}
+			if (!q.ok) break;
+			EraseAt(cmds, at);
+		} else if (rec[0] == JR_INSERT) {
+			uint64_t at = q.Varint();
+			Command c;
+			if (!q.ok || at > cmds.size() || !BoardGetCommand(q, styles, c)) break;
+			cmds.insert(cmds.begin() + (size_t)at, std::move(c));
+		} else break;
+		r.p = rec + n + 4;
+	}
+	out.swap(cmds);
+	return true;
+}
+// Called before the overlay exists. A journal left behind means the last session did not
+// exit cleanly; offer its board, then start journaling (which rewrites the file either way).
+static void RecoverJournal() {
+	if (!g_journal) return;
+	vector<Command> cmds;
+	bool found = MapFileRead(JOURNAL_PATH, [&](const uint8_t* p, size_t n) { return ParseJournal(p, n, cmds); });
+	if (found && !cmds.empty() &&
+		MessageBoxW(nullptr, L"Easy Draw did not close normally last time.\nRestore the drawing from that session?", L"Easy Draw", MB_YESNO | MB_ICONQUESTION | MB_TOPMOST) == IDYES)
+		g_cmds = std::move(cmds);
+	StartJournal();
+}
+
+// ---------- Session history (replay) ----------
+// Every board change is also kept in memory with its time since startup: adds copy the
+// command into g_histCmds and refer to it by id, pops and clears carry no data. A keyframe
+// (the board as a list of ids) is taken once the events since the last one exceed
+// max(256, board size / 4), so memory stays linear in the number of events while seeking
+// replays at most that many events from the nearest keyframe.
+static void HistoryKeyframeIfDue() {
+	size_t since = g_histEvents.size() - g_histKeys.back().event;
+	if (since >= max<size_t>(256, g_histBoard.size() / 4)) g_histKeys.push_back({ g_histEvents.size(), g_histBoard });
+}
+static void ApplyHistEvent(const HistEvent& e, vector<uint32_t>& board) {
+	if (e.op == JR_ADD) board.push_back(e.id);
+	else if (e.op == JR_POP) {
+		if (!board.empty()) board.pop_back();
+	} else if (e.op == JR_ERASE) EraseAt(board, g_histErases[e.id].at);
+	else if (e.op == JR_INSERT) {
+		vector<uint32_t> ids = g_histErases[e.id].ids;
+		InsertAt(board, g_histErases[e.id].at, ids);
+	} else board.clear();
+}
+static void HistoryPush(uint8_t op, uint32_t id) {
+	HistEvent e{ (uint32_t)(GetTickCount64() - g_histStart), op, id };
+	ApplyHistEvent(e, g_histBoard);
+	g_histEvents.push_back(e);
+	HistoryKeyframeIfDue();
+}
+static void HistoryOp(uint8_t op, const Command* c = nullptr) {
+	uint32_t id = 0;
+	if (op == JR_ADD) {
+		id = (uint32_t)g_histCmds.size();
+		g_histCmds.push_back(*c);
+	} else if (op == JR_CLEAR) g_histLead = g_cmdLead = 0;
+	HistoryPush(op, id);
+}
+// g_histBoard position of the command at g_cmds[p], p past the flattened lead.
+static uint32_t HistPos(uint32_t p) {
+	return (uint32_t)(p - g_cmdLead + g_histLead);
+}
+// Erases keep the ids they removed so undoing one re-inserts them without copying commands.
+static uint32_t HistoryErase(const vector<uint32_t>& at) {
+	HistErase rec;
+	for (uint32_t p : at) rec.at.push_back(HistPos(p));
+	for (uint32_t p : rec.at) rec.ids.push_back(g_histBoard[p]);
+	uint32_t id = (uint32_t)g_histErases.size();
+	g_histErases.push_back(std::move(rec));
+	HistoryPush(JR_ERASE, id);
+	return id;
+}
+static void HistoryUnerase(uint32_t rec) { HistoryPush(JR_INSERT, rec); }
+// Commands new to the history that went in at `at` (eraser compaction's trimmed strokes).
+static void HistoryInsert(const vector<uint32_t>& at) {
+	HistErase rec;
+	for (uint32_t p : at) {
+		rec.at.push_back(HistPos(p));
+		rec.ids.push_back((uint32_t)g_histCmds.size());
+		g_histCmds.push_back(g_cmds[p]);
+	}
+	uint32_t id = (uint32_t)g_histErases.size();
+	g_histErases.push_back(std::move(rec));
+	HistoryPush(JR_INSERT, id);
+}
+// g_cmds[0, n) is about to become `kept` commands (0 or 1 raster). Replay keeps showing the
+// vector commands they were drawn from, so nothing is recorded and no raster is copied here.
+static void HistoryFlatten(uint32_t n, size_t kept) {
+	g_histLead = HistPos(n);
+	g_cmdLead = kept;
+}
+// The board was swapped wholesale (undo past D, board load): record it as clear + adds.
+static void HistoryReplaced() {
+	HistoryOp(JR_CLEAR);
+	for (const Command& c : g_cmds) HistoryOp(JR_ADD, &c);
+}
+static void StartHistory() {
+	g_histStart = GetTickCount64();
+	g_histKeys.assign(1, HistKeyframe{});
+	for (const Command& c : g_cmds) HistoryOp(JR_ADD, &c);
+}
+// Drops the older half of the session (MEMORY_BUDGET_MB): replay then starts at the keyframe
+// nearest the middle, showing its board, and commands only the dropped events used are freed.
+// Ids are renumbered, keeping the erase records undo can still reach. False if no keyframe
+// past the first lies in the older half.
+static bool TrimHistory() {
+	size_t k = 0;
+	while (k + 1 < g_histKeys.size() && g_histKeys[k + 1].event <= g_histEvents.size() / 2) ++k;
+	if (k == 0) return false;
+	const size_t cut = g_histKeys[k].event;
+	const uint32_t cutMs = g_histEvents[cut - 1].ms;
+	vector<uint32_t> cmdMap(g_histCmds.size(), UINT32_MAX), recMap(g_histErases.size(), UINT32_MAX);
+	vector<Command> cmds;
+	vector<HistErase> recs;
+	auto keepCmd = [&](uint32_t& id) {
+		if (cmdMap[id] == UINT32_MAX) {
+			cmdMap[id] = (uint32_t)cmds.size();
+			cmds.push_back(std::move(g_histCmds[id]));
+		}
+		id = cmdMap[id];
+	};
+	auto keepRec = [&](uint32_t& id) {
+		if (recMap[id] == UINT32_MAX) {
+			recMap[id] = (uint32_t)recs.size();
+			recs.push_back(std::move(g_histErases[id]));
+			for (uint32_t& c : recs.back().ids) keepCmd(c);
+		}
+		id = recMap[id];
+	};
+	vector<HistKeyframe> keys(std::make_move_iterator(g_histKeys.begin() + k), std::make_move_iterator(g_histKeys.end()));
+	for (HistKeyframe& kf : keys) {
+		kf.event -= cut;
+		for (uint32_t& id : kf.board) keepCmd(id);
+	}
+	vector<HistEvent> events(g_histEvents.begin() + cut, g_histEvents.end());
+	for (HistEvent& e : events) {
+		e.ms -= cutMs;
+		if (e.op == JR_ADD) keepCmd(e.id);
+		else if (e.op == JR_ERASE || e.op == JR_INSERT) keepRec(e.id);
+	}
+	for (uint32_t& id : g_histBoard) keepCmd(id);
+	for (EditOp& op : g_undoOps)
+		if (op.kind == EditKind::Erase) keepRec(op.hist);
+	g_histCmds = std::move(cmds);
+	g_histErases = std::move(recs);
+	g_histEvents = std::move(events);
+	g_histKeys = std::move(keys);
+	g_histStart += cutMs;
+	return true;
+}
+
+// Shows the board as it was `ms` into the session. Moving forward past adds only draws the
+// new commands on top of the content layer; anything else restarts from the nearest
+// keyframe and repaints through RepaintContent.
+static void ReplaySeek(uint32_t ms) {
+	g_rpClock = min(ms, g_rpDuration);
+	auto evEnd = g_histEvents.begin() + g_rpEnd;
+	size_t n = std::upper_bound(g_histEvents.begin(), evEnd, g_rpClock, [](uint32_t t, const HistEvent& e) { return t < e.ms; }) - g_histEvents.begin();
+	if (n == g_rpApplied) return;
+	const HistKeyframe& k = *(std::upper_bound(g_histKeys.begin(), g_histKeys.end(), n, [](size_t i, const HistKeyframe& kf) { return i < kf.event; }) - 1);
+	
+	bool addsOnly = n > g_rpApplied && g_rpApplied >= k.event;
+	for (size_t i = g_rpApplied; addsOnly && i < n; ++i) addsOnly = g_histEvents[i].op == JR_ADD;
+	if (addsOnly) {
+		size_t first = g_rpBoard.size();
+		for (size_t i = g_rpApplied; i < n; ++i) g_rpBoard.push_back(g_histEvents[i].id);
+		AppendContent(g_rpBoard.data() + first, g_rpBoard.size() - first);
+	} else {
+		size_t from = k.event;
+		if (n > g_rpApplied && g_rpApplied >= k.event) from = g_rpApplied;
+		else g_rpBoard = k.board;
+		for (size_t i = from; i < n; ++i) ApplyHistEvent(g_histEvents[i], g_rpBoard);
+		RepaintContent();
+	}
+	g_rpApplied = n;
+}
+
+// ---------- Input ops ----------
+// Every change to g_cmds goes through these so the journal, the history and the spatial
+// index see it.
+static void NoteBoardOp(uint8_t op, const Command* c = nullptr) {
+	if (op != JR_ADD) {
+		g_grid.valid = false;
+		++g_boardEpoch;
+	}
+	JournalOp(op, c);
+	HistoryOp(op, c);
+}
+static void NoteBoardReplaced() {
+	g_grid.valid = false;
+	++g_boardEpoch;
+	JournalCompact();
+	HistoryReplaced();
+}
+// Call before removing the commands at `at`; returns the history record for the EditOp.
+static uint32_t NoteBoardErase(const vector<uint32_t>& at) {
+	g_grid.valid = false;
+	++g_boardEpoch;
+	JournalErase(at);
+	return HistoryErase(at);
+}
+// Call before flattening g_cmds[0, n) into `kept` commands: the journal drops them, the
+// history keeps them.
+static void NoteBoardFlatten(const vector<uint32_t>& gone, uint32_t n, size_t kept) {
+	g_grid.valid = false;
+	++g_boardEpoch;
+	JournalErase(gone);
+	HistoryFlatten(n, kept);
+}
+// Call after putting an Erase op's commands back.
+static void NoteBoardUnerase(const EditOp& op) {
+	g_grid.valid = false;
+	++g_boardEpoch;
+	for (uint32_t p : op.at) JournalOp(JR_INSERT, &g_cmds[p], p);
+	HistoryUnerase(op.hist);
+}
+static D2D1_RECT_F UnionBounds(const vector<Command>& cmds) {
+	D2D1_RECT_F u{ 0, 0, -1, -1 };
+	for (const Command& c : cmds) {
+		D2D1_RECT_F b = CommandBounds(c);
+		if (b.right < b.left) continue;
+		if (u.right < u.left) u = b;
+		else u = D2D1::RectF(min(u.left, b.left), min(u.top, b.top), max(u.right, b.right), max(u.bottom, b.bottom));
+	}
+	return u;
+}
+// Compaction waits for a few idle seconds after the last edit.
+static void ScheduleCompaction() {
+	if (g_hwnd) SetTimer(g_hwnd, COMPACT_TIMER_ID, 3000, nullptr);
+}
+static void ClearRedo() {
+	g_redoOps.clear();
+}
+// Ops older than UNDO_DEPTH fall off the bottom; what they touched can then be compacted.
+static void PushUndo(EditOp&& op) {
+	g_undoOps.push_back(std::move(op));
+	if (g_undoDepth > 0 && g_undoOps.size() > (size_t)g_undoDepth) g_undoOps.pop_front();
+}
+// Takes the command over: the live stroke's points (and its cached geometry) move onto the
+// board without a copy.
+static void CommitCommand(Command&& c) {
+	c.pts.shrink_to_fit();   // the next stroke starts where this one ends
+	g_cmds.push_back(std::move(c));
+	EditOp op;
+	op.low = (uint32_t)g_cmds.size() - 1;
+	PushUndo(std::move(op));
+	ClearRedo();
+	NoteBoardOp(JR_ADD, &g_cmds.back());
+	ScheduleCompaction();
+}
+// D and board loads: the old board goes on the undo stack whole.
+static void ReplaceBoard(vector<Command>&& board) {
+	EditOp op;
+	op.kind = EditKind::Replace;
+	op.cmds = std::move(g_cmds);
+	g_cmds = std::move(board);
+	DropRasterBitmaps(op.cmds);
+	PushUndo(std::move(op));
+	ClearRedo();
+	NoteBoardReplaced();
+}
+
+// Object eraser: the eraser square is swept along the pointer path and every stroke or text it
+// touches is hidden and its area repainted; releasing removes the hidden commands as one Erase.
+// Pixel-eraser strokes are not objects and are never picked, nor is flattened content.
+static bool SegmentTouchesRect(D2D1_POINT_2F a, D2D1_POINT_2F b, const D2D1_RECT_F& r) {
+	float t0 = 0.f, t1 = 1.f, dx = b.x - a.x, dy = b.y - a.y;
+	const float p[4] = { -dx, dx, -dy, dy };
+	const float q[4] = { a.x - r.left, r.right - a.x, a.y - r.top, r.bottom - a.y };
+	for (int i = 0; i < 4; ++i) {
+		if (p[i] == 0.f) {
+			if (q[i] < 0.f) return false;
+			continue;
+		}
+		float t = q[i] / p[i];
+		if (p[i] < 0.f) {
+			if (t > t1) return false;
+			t0 = max(t0, t);
+		} else {
+			if (t < t0) return false;
+			t1 = min(t1, t);
+		}
+	}
+	return true;
+}
+static bool EraserTouches(const Command& c, const D2D1_RECT_F& sq) {
+	if (c.eraser || c.type == CmdType::Raster) return false;
+	if (c.type == CmdType::Text) return RectsTouch(CommandBounds(c), sq);
+	float h = 0.5f * max(1.f, c.style.width);
+	D2D1_RECT_F r = D2D1::RectF(sq.left - h, sq.top - h, sq.right + h, sq.bottom + h);
+	if (c.pts.size() == 1) return SegmentTouchesRect(c.pts[0], c.pts[0], r);
+	for (size_t i = 1; i < c.pts.size(); ++i)
+		if (SegmentTouchesRect(c.pts[i - 1], c.pts[i], r)) return true;
+	return false;
+}
+static void ObjectEraseTo(float x, float y) {
+	static vector<uint32_t> hits;
+	const float r = 0.5f * (float)g_eraserSize;
+	const D2D1_POINT_2F a = g_objLast;
+	const float dx = x - a.x, dy = y - a.y;
+	const int steps = max(1, (int)std::ceil(std::sqrt(dx * dx + dy * dy) / max(1.f, r)));
+	vector<Command> touched;
+	D2D1_RECT_F dirty{ 0, 0, -1, -1 };
+	for (int k = 1; k <= steps; ++k) {
+		float px = a.x + dx * k / steps, py = a.y + dy * k / steps;
+		D2D1_RECT_F sq = D2D1::RectF(px - r, py - r, px + r, py + r);
+		GridQuery(sq, hits);
+		for (uint32_t i : hits) {
+			if (g_objHidden[i] || !EraserTouches(g_cmds[i], sq)) continue;
+			g_objHidden[i] = 1;
+			D2D1_RECT_F b = CommandBounds(g_cmds[i]);
+			if (dirty.right < dirty.left) dirty = b;
+			else dirty = D2D1::RectF(min(dirty.left, b.left), min(dirty.top, b.top), max(dirty.right, b.right), max(dirty.bottom, b.bottom));
+		}
+	}
+	g_objLast = D2D1::Point2F(x, y);
+	if (dirty.right >= dirty.left) RepaintContentRect(dirty);
+	RenderFrame(true);
+}
+static void BeginObjectErase(float x, float y) {
+	g_drawing = true;
+	g_objErasing = true;
+	g_live = Command{};
+	g_objHidden.assign(g_cmds.size(), 0);
+	g_objLast = D2D1::Point2F(x, y);
+	ObjectEraseTo(x, y);
+}
+static void FinishObjectErase() {
+	g_objErasing = false;
+	EditOp op;
+	op.kind = EditKind::Erase;
+	for (uint32_t i = 0; i < (uint32_t)g_objHidden.size(); ++i)
+		if (g_objHidden[i]) op.at.push_back(i);
+	g_objHidden.clear();
+	if (op.at.empty()) return;
+	op.low = op.at[0];
+	op.hist = NoteBoardErase(op.at);
+	EraseAt(g_cmds, op.at, &op.cmds);
+	PushUndo(std::move(op));
+	ClearRedo();
+	ScheduleCompaction();
 }
 
-// ---------- Input ops ----------
 static void BeginStroke(float x, float y) {
+	if (g_eraser && g_objectEraser) {
+		BeginObjectErase(x, y);
+		return;
+	}
 	g_drawing = true;
 	g_live = Command{};
 	g_live.type = CmdType::Stroke;
@@ -1370,19 +4434,50 @@ static void BeginStroke(float x, float y) {
 		g_live.style.color = c;
 	} else g_live.style.width = ActiveStyle().width;
 	g_live.pts.push_back(D2D1::Point2F(x, y));
+	ResetLiveStroke();
+	ClearInkPrediction();
 	RenderFrame(true);
 }
 static void AddToStroke(float x, float y) {
 	if (!g_drawing) return;
+	if (g_objErasing) {
+		ObjectEraseTo(x, y);
+		return;
+	}
+#if EASY_DRAW_COUNT_ALLOCS
+	const size_t allocs = g_allocCount;
+	const bool grows = g_live.pts.size() == g_live.pts.capacity() || g_live.pts.size() % LIVE_BLOCK == 0;
+#endif
+	const D2D1_POINT_2F a = g_live.pts.back();
 	g_live.pts.push_back(D2D1::Point2F(x, y));
-	RenderFrame(true);
+	D2D1_RECT_F area = D2D1::RectF(min(a.x, x), min(a.y, y), max(a.x, x), max(a.y, y));
+	auto cover = [&area](D2D1_POINT_2F p) {
+		area = D2D1::RectF(min(area.left, p.x), min(area.top, p.y), max(area.right, p.x), max(area.bottom, p.y));
+	};
+	if (g_inkTailOn) cover(g_inkTail);   // the old tail must be wiped
+	UpdateInkTail(g_live.pts.back());
+	if (g_inkTailOn) cover(g_inkTail);
+	const float r = g_live.style.width * 0.5f + 2.f;
+	RenderFrameAround(true, D2D1::RectF(area.left - r, area.top - r, area.right + r, area.bottom + r));
+#if EASY_DRAW_COUNT_ALLOCS
+	// Once the point buffer has room, a point (prediction and redraw included) must not allocate
+	// outside the points that start a new point slice or live block. The count sees every
+	// operator new call in the program, but not what D2D allocates on its own heap inside DrawLine.
+	assert(grows || g_allocCount == allocs);
+#endif
 }
 static void EndStroke() {
 	if (!g_drawing) return;
 	g_drawing = false;
-	g_cmds.push_back(g_live);
-	while (!g_redo.empty()) g_redo.pop();
-	RepaintContent();
+	ClearInkPrediction();
+	if (g_objErasing) {
+		FinishObjectErase();
+		RenderFrame(false);
+		return;
+	}
+	CommitCommand(std::move(g_live));
+	g_live = Command{};
+	AppendCommands({ &g_cmds.back() });
 	RenderFrame(false);
 }
 static void StartText(float x, float y) {
@@ -1402,57 +4497,435 @@ static void StartText(float x, float y) {
 static void CommitText() {
 	if (!g_textMode) return;
 	if (!g_live.text.empty()) {
-		g_cmds.push_back(g_live);
-		while (!g_redo.empty()) g_redo.pop();
+		CommitCommand(std::move(g_live));
+		AppendCommands({ &g_cmds.back() });
 	}
+	g_live = Command{};
 	g_textMode = false;
 	g_eraser = g_prevEraser;
 	g_highlight = g_prevHighlight;
 	TextClearHistory();
-	RepaintContent();
 	RenderFrame(false);
 }
+// An object-erase drag holds board positions from when it began, so the board-changing keys
+// finish it first.
 static void DeleteAll() {
-	if (!g_cmds.empty()) {
-		g_undoSnaps.push(g_cmds);
-		while (!g_redoSnaps.empty()) g_redoSnaps.pop();
-	}
-	g_cmds.clear();
-	while (!g_redo.empty()) g_redo.pop();
+	if (g_objErasing) EndStroke();
+	if (!g_cmds.empty()) ReplaceBoard(vector<Command>());
+	ResetPointArena();
 	RepaintContent();
 	RenderFrame(false);
 }
+// Undoing or redoing a single add or an erase repaints only the area it covered.
 static void Undo() {
-	if (!g_cmds.empty()) {
-		g_redo.push(g_cmds.back());
+	if (g_objErasing) EndStroke();
+	if (g_undoOps.empty()) return;
+	EditOp op = std::move(g_undoOps.back());
+	g_undoOps.pop_back();
+	if (op.kind == EditKind::Add) {
+		if (g_cmds.empty()) return;
+		op.cmd = std::move(g_cmds.back());
 		g_cmds.pop_back();
+		NoteBoardOp(JR_POP);
+		RepaintContentRect(CommandBounds(op.cmd));
+	} else if (op.kind == EditKind::Erase) {
+		D2D1_RECT_F dirty = UnionBounds(op.cmds);
+		InsertAt(g_cmds, op.at, op.cmds);
+		op.cmds.clear();
+		NoteBoardUnerase(op);
+		RepaintContentRect(dirty);
+	} else {
+		g_cmds.swap(op.cmds);
+		DropRasterBitmaps(op.cmds);
+		NoteBoardReplaced();
 		RepaintContent();
-		RenderFrame(false);
-		return;
-	}
-	if (!g_undoSnaps.empty()) {
-		g_redoSnaps.push(vector<Command>());
-		g_cmds = g_undoSnaps.top();
-		g_undoSnaps.pop();
-		RepaintContent();
-		RenderFrame(false);
 	}
+	g_redoOps.push_back(std::move(op));
+	RenderFrame(false);
 }
 static void Redo() {
-	if (!g_redo.empty()) {
-		g_cmds.push_back(g_redo.top());
-		g_redo.pop();
+	if (g_objErasing) EndStroke();
+	if (g_redoOps.empty()) return;
+	EditOp op = std::move(g_redoOps.back());
+	g_redoOps.pop_back();
+	if (op.kind == EditKind::Add) {
+		g_cmds.push_back(std::move(op.cmd));
+		op.cmd = Command{};
+		NoteBoardOp(JR_ADD, &g_cmds.back());
+		RepaintContentRect(CommandBounds(g_cmds.back()));
+	} else if (op.kind == EditKind::Erase) {
+		op.hist = NoteBoardErase(op.at);
+		EraseAt(g_cmds, op.at, &op.cmds);
+		RepaintContentRect(UnionBounds(op.cmds));
+	} else {
+		g_cmds.swap(op.cmds);
+		DropRasterBitmaps(op.cmds);
+		NoteBoardReplaced();
 		RepaintContent();
-		RenderFrame(false);
+	}
+	PushUndo(std::move(op));
+	RenderFrame(false);
+}
+
+// ---------- Eraser compaction ----------
+// The pixel eraser only ever clears pixels, so once an eraser and the strokes under it are
+// past undo reach the board can be rewritten with the same look but less to draw: strokes
+// lying wholly under later erasers are dropped, wholly erased runs of segments are cut out of
+// partly erased strokes, and erasers left touching nothing are dropped as well. The scan runs
+// on a worker over a copy of the sealed prefix; its plan is applied on the UI thread only if
+// nothing but appends happened to the board in the meantime (g_boardEpoch).
+struct CompactPlan {
+	uint32_t n = 0;                                    // prefix length the plan is for
+	vector<uint8_t> drop;                              // per prefix command
+	vector<std::pair<uint32_t, vector<vector<D2D1_POINT_2F>>>> trims;   // index, kept pieces
+};
+static const UINT WM_APP_COMPACTED = WM_APP + 104;
+std::thread       g_compactThread;
+std::atomic<bool> g_compactStop{ false };
+bool              g_compactBusy = false;
+uint64_t          g_compactEpoch = 0;             // g_boardEpoch the running scan started from
+uint32_t          g_compactMark = 0;              // prefix length the last scan covered...
+uint64_t          g_compactMarkEpoch = ~0ull;     // ...valid while the board epoch is this
+CompactPlan       g_compactPlan;
+
+// Commands below this position are referenced by no undo or redo op.
+static size_t SealedPrefix() {
+	size_t n = g_cmds.size();
+	for (const EditOp& op : g_undoOps) n = min<size_t>(n, op.low);
+	for (const EditOp& op : g_redoOps) n = min<size_t>(n, op.low);
+	return n;
+}
+static float PointSegDist2(D2D1_POINT_2F p, D2D1_POINT_2F a, D2D1_POINT_2F b) {
+	float dx = b.x - a.x, dy = b.y - a.y, len2 = dx * dx + dy * dy;
+	float t = len2 > 0.f ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / len2 : 0.f;
+	t = min(1.f, max(0.f, t));
+	float ex = a.x + t * dx - p.x, ey = a.y + t * dy - p.y;
+	return ex * ex + ey * ey;
+}
+static float SegSegDist2(D2D1_POINT_2F a, D2D1_POINT_2F b, D2D1_POINT_2F c, D2D1_POINT_2F d) {
+	auto cross = [](D2D1_POINT_2F o, D2D1_POINT_2F p, D2D1_POINT_2F q) { return (p.x - o.x) * (q.y - o.y) - (p.y - o.y) * (q.x - o.x); };
+	float d1 = cross(a, b, c), d2 = cross(a, b, d), d3 = cross(c, d, a), d4 = cross(c, d, b);
+	if (((d1 > 0.f && d2 < 0.f) || (d1 < 0.f && d2 > 0.f)) && ((d3 > 0.f && d4 < 0.f) || (d3 < 0.f && d4 > 0.f))) return 0.f;
+	return min(min(PointSegDist2(a, c, d), PointSegDist2(b, c, d)), min(PointSegDist2(c, a, b), PointSegDist2(d, a, b)));
+}
+// Segment k of a polyline (a stroke's PointBuf or a compaction piece); a single point is a zero-length segment.
+template<typename Pts> static inline void PolySeg(const Pts& pts, size_t k, D2D1_POINT_2F& a, D2D1_POINT_2F& b) {
+	a = pts[k];
+	b = pts.size() > 1 ? pts[k + 1] : pts[k];
+}
+template<typename Pts> static inline size_t PolySegCount(const Pts& pts) {
+	return pts.size() > 1 ? pts.size() - 1 : pts.size();
+}
+// True if the disc of radius `need` around p is inside one eraser's cleared area (round caps
+// and joins, so that area is every point within half the eraser width of its path).
+static bool DiscErased(D2D1_POINT_2F p, float need, const vector<const Command*>& erasers) {
+	for (const Command* e : erasers) {
+		float room = 0.5f * max(1.f, e->style.width) - need;
+		if (room < 0.f) continue;
+		const D2D1_RECT_F& b = e->bounds;
+		if (p.x < b.left || p.x > b.right || p.y < b.top || p.y > b.bottom) continue;
+		D2D1_POINT_2F s0, s1;
+		for (size_t k = 0; k < PolySegCount(e->pts); ++k) {
+			PolySeg(e->pts, k, s0, s1);
+			if (PointSegDist2(p, s0, s1) <= room * room) return true;
+		}
+	}
+	return false;
+}
+// Per segment of stroke c: is all of its ink under the erasers? Samples every 2 px, each
+// needing a disc of half the width plus 1 px for the sample spacing and 1 px for antialiasing.
+static void ErasedSegments(const Command& c, const vector<const Command*>& erasers, vector<uint8_t>& cov) {
+	const float ds = 2.f, need = 0.5f * max(1.f, c.style.width) + 2.f;
+	cov.assign(PolySegCount(c.pts), 0);
+	D2D1_POINT_2F a, b;
+	for (size_t k = 0; k < cov.size(); ++k) {
+		PolySeg(c.pts, k, a, b);
+		float dx = b.x - a.x, dy = b.y - a.y;
+		int m = max(1, (int)std::ceil(std::sqrt(dx * dx + dy * dy) / ds));
+		bool all = true;
+		for (int i = 0; i <= m && all; ++i)
+			all = DiscErased(D2D1::Point2F(a.x + dx * i / m, a.y + dy * i / m), need, erasers);
+		cov[k] = all ? 1 : 0;
+	}
+}
+template<typename Pts> static bool InkTouchesEraser(const Pts& pts, float halfW, const Command& e) {
+	float reach = 0.5f * max(1.f, e.style.width) + halfW + 1.f;
+	D2D1_RECT_F eb = D2D1::RectF(e.bounds.left - halfW, e.bounds.top - halfW, e.bounds.right + halfW, e.bounds.bottom + halfW);
+	D2D1_POINT_2F a, b, c, d;
+	for (size_t i = 0; i < PolySegCount(pts); ++i) {
+		PolySeg(pts, i, a, b);
+		D2D1_RECT_F sb = D2D1::RectF(min(a.x, b.x), min(a.y, b.y), max(a.x, b.x), max(a.y, b.y));
+		if (!RectsTouch(sb, eb)) continue;
+		for (size_t k = 0; k < PolySegCount(e.pts); ++k) {
+			PolySeg(e.pts, k, c, d);
+			if (SegSegDist2(a, b, c, d) <= reach * reach) return true;
+		}
+	}
+	return false;
+}
+// Commands below `from` were settled by the previous scan: only strokes under erasers at or
+// above it can change, and only erasers at or above it or over a changed stroke can go.
+static void CompactWorker(vector<Command> snap, uint32_t from) {
+	CompactPlan plan;
+	plan.n = (uint32_t)snap.size();
+	plan.drop.assign(snap.size(), 0);
+	vector<uint8_t> changed(snap.size(), 0);
+	vector<vector<vector<D2D1_POINT_2F>>*> pieces(snap.size(), nullptr);
+	vector<const Command*> erasers;
+	vector<uint8_t> cov;
+	for (size_t s = 0; s < snap.size() && !g_compactStop; ++s) {
+		const Command& c = snap[s];
+		if (c.eraser || c.type != CmdType::Stroke || c.pts.empty()) continue;
+		erasers.clear();
+		bool fresh = false;
+		for (size_t e = s + 1; e < snap.size(); ++e)
+			if (snap[e].eraser && !snap[e].pts.empty() && RectsTouch(snap[e].bounds, c.bounds)) {
+				erasers.push_back(&snap[e]);
+				fresh = fresh || e >= from;
+			}
+		if (!fresh) continue;
+		ErasedSegments(c, erasers, cov);
+		size_t erased = std::count(cov.begin(), cov.end(), (uint8_t)1);
+		if (erased == cov.size()) {
+			plan.drop[s] = changed[s] = 1;
+			continue;
+		}
+		// Overlapping pieces would blend twice, so translucent highlighter strokes stay whole.
+		if (erased == 0 || c.highlight || c.pts.size() < 2) continue;
+		vector<vector<D2D1_POINT_2F>> keep;
+		size_t kept = 0;
+		for (size_t k = 0; k < cov.size();) {
+			if (cov[k]) {
+				++k;
+				continue;
+			}
+			size_t j = k;
+			while (j < cov.size() && !cov[j]) ++j;
+			keep.emplace_back(c.pts.begin() + k, c.pts.begin() + j + 1);
+			kept += j + 1 - k;
+			k = j;
+		}
+		if (kept >= c.pts.size()) continue;
+		plan.trims.emplace_back((uint32_t)s, std::move(keep));
+		changed[s] = 1;
+	}
+	for (auto& t : plan.trims) pieces[t.first] = &t.second;
+	// An eraser that no longer reaches any ink below it changes nothing and goes too.
+	for (size_t e = 0; e < snap.size() && !g_compactStop; ++e) {
+		const Command& er = snap[e];
+		if (!er.eraser) continue;
+		bool recheck = e >= from;
+		for (size_t s = 0; s < e && !recheck; ++s) recheck = changed[s] && RectsTouch(snap[s].bounds, er.bounds);
+		if (!recheck) continue;
+		bool touches = false;
+		for (size_t s = 0; s < e && !touches; ++s) {
+			const Command& c = snap[s];
+			if (c.eraser || plan.drop[s] || !RectsTouch(c.bounds, er.bounds)) continue;
+			if (c.type != CmdType::Stroke) touches = true;
+			else if (pieces[s]) {
+				for (const auto& piece : *pieces[s])
+					if (InkTouchesEraser(piece, 0.5f * max(1.f, c.style.width), er)) touches = true;
+			} else touches = InkTouchesEraser(c.pts, 0.5f * max(1.f, c.style.width), er);
+		}
+		if (!touches) plan.drop[e] = 1;
+	}
+	g_compactPlan = std::move(plan);
+	PostMessageW(g_hwnd, WM_APP_COMPACTED, 0, 0);
+}
+// Starts a scan if erasers have entered the sealed prefix since the last one; true if it did.
+static bool StartCompaction() {
+	if (g_compactBusy) return true;
+	if (g_drawing || g_replaying) {
+		ScheduleCompaction();
+		return true;
+	}
+	uint32_t n = (uint32_t)SealedPrefix();
+	if (g_compactMarkEpoch != g_boardEpoch || g_compactMark > n) g_compactMark = 0;
+	bool fresh = false;
+	for (uint32_t i = g_compactMark; i < n && !fresh; ++i) fresh = g_cmds[i].eraser;
+	if (!fresh) {
+		g_compactMark = n;
+		g_compactMarkEpoch = g_boardEpoch;
+		return false;
+	}
+	for (uint32_t i = 0; i < n; ++i) CommandBounds(g_cmds[i]);
+	vector<Command> snap(g_cmds.begin(), g_cmds.begin() + n);
+	for (Command& c : snap) {
+		// Bounds are all the scan needs, and bitmaps and geometries stay on this thread.
+		c.raster.reset();
+		c.geom.reset();
+	}
+	g_compactEpoch = g_boardEpoch;
+	g_compactBusy = true;
+	g_compactThread = std::thread(CompactWorker, std::move(snap), g_compactMark);
+	return true;
+}
+// Swaps the first n commands (all sealed) for `prefix`: `gone` lists the old positions that did
+// not survive as they were, `added` the new positions of commands that were not there before.
+// A flatten is kept out of the session history (see HistoryFlatten).
+static void ReplaceSealedPrefix(uint32_t n, vector<Command>& prefix, const vector<uint32_t>& gone, const vector<uint32_t>& added, bool flatten = false) {
+	if (flatten) NoteBoardFlatten(gone, n, prefix.size());
+	else NoteBoardErase(gone);
+	for (uint32_t p : gone)
+		if (g_cmds[p].raster) SafeRelease(g_cmds[p].raster->bmp);
+	g_cmds.erase(g_cmds.begin(), g_cmds.begin() + n);
+	g_cmds.insert(g_cmds.begin(), std::make_move_iterator(prefix.begin()), std::make_move_iterator(prefix.end()));
+	for (uint32_t p : added) JournalOp(JR_INSERT, &g_cmds[p], p);
+	if (!added.empty() && !flatten) HistoryInsert(added);
+	// Everything the undo stacks refer to sits above the prefix and moves with its end.
+	int64_t delta = (int64_t)prefix.size() - n;
+	for (auto* ops : { &g_undoOps, &g_redoOps })
+		for (EditOp& op : *ops) {
+			op.low = (uint32_t)(op.low + delta);
+			for (uint32_t& p : op.at) p = (uint32_t)(p + delta);
+		}
+	g_compactMark = (uint32_t)prefix.size();
+	g_compactMarkEpoch = g_boardEpoch;
+}
+static void ApplyCompaction() {
+	CompactPlan plan = std::move(g_compactPlan);
+	g_compactPlan = CompactPlan{};
+	if (g_compactEpoch != g_boardEpoch || SealedPrefix() < plan.n || g_objErasing || g_replaying) {
+		ScheduleCompaction();
 		return;
 	}
-	if (!g_redoSnaps.empty()) {
-		g_undoSnaps.push(g_cmds);
-		g_cmds.clear();
-		g_redoSnaps.pop();
-		RepaintContent();
-		RenderFrame(false);
+	if (plan.trims.empty() && std::find(plan.drop.begin(), plan.drop.end(), (uint8_t)1) == plan.drop.end()) {
+		g_compactMark = plan.n;
+		g_compactMarkEpoch = g_boardEpoch;
+		return;
 	}
+	vector<uint32_t> gone, added;
+	vector<Command> prefix;
+	size_t t = 0;
+	for (uint32_t i = 0; i < plan.n; ++i) {
+		if (t < plan.trims.size() && plan.trims[t].first == i) {
+			gone.push_back(i);
+			for (auto& piece : plan.trims[t].second) {
+				Command c = g_cmds[i];
+				c.pts = std::move(piece);
+				c.hasBounds = false;
+				c.geom.reset();
+				added.push_back((uint32_t)prefix.size());
+				prefix.push_back(std::move(c));
+			}
+			++t;
+		} else if (plan.drop[i]) gone.push_back(i);
+		else prefix.push_back(std::move(g_cmds[i]));
+	}
+	ReplaceSealedPrefix(plan.n, prefix, gone, added);
+}
+// WM_APP_COMPACTED handler.
+static void StopCompaction() {
+	g_compactStop = true;
+	if (g_compactThread.joinable()) g_compactThread.join();
+	g_compactBusy = false;
+}
+
+// ---------- Flattening ----------
+// Once the sealed prefix (commands past UNDO_DEPTH) holds more than FLATTEN_MB of vector data,
+// it is drawn once into a raster command cropped to its extent, which replaces it. Repaints then
+// cost one bitmap plus what undo can still reach; the journal and board files carry the raster
+// as a QOI image, while the session history keeps the commands it was drawn from. Runs after
+// compaction, when the board has been idle.
+// Points are left out: their slices are shared by the board, undo and history, so the point
+// arena is counted once on its own (MemoryUsage::points). A cached stroke geometry is counted
+// as one copy of the points.
+static size_t CommandBytes(const Command& c) {
+	return sizeof(Command) + c.text.capacity() * sizeof(wchar_t) + (c.raster ? c.raster->qoi.capacity() : 0) +
+		(c.geom ? c.geomPts * sizeof(D2D1_POINT_2F) : 0);
+}
+// Draws g_cmds[0, n) into `layer` (its x/y/w/h set) and keeps both the bitmap and its QOI.
+static bool RenderRasterLayer(RasterLayer& layer, uint32_t n) {
+	D2D1_BITMAP_PROPERTIES1 props{};
+	props.pixelFormat = { DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED };
+	props.dpiX = 96.f;
+	props.dpiY = 96.f;
+	props.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET;
+	const D2D1_SIZE_U size{ (UINT32)layer.w, (UINT32)layer.h };
+	ID2D1Bitmap1* bmp = nullptr;
+	ID2D1Bitmap1* cpu = nullptr;
+	if (FAILED(g_dc->CreateBitmap(size, nullptr, 0, &props, &bmp))) return false;
+	props.bitmapOptions = D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW;
+	if (FAILED(g_dc->CreateBitmap(size, nullptr, 0, &props, &cpu))) {
+		SafeRelease(bmp);
+		return false;
+	}
+	D2D1_MATRIX_3X2_F oldXf;
+	g_dc->GetTransform(&oldXf);
+	g_dc->SetTarget(bmp);
+	g_dc->BeginDraw();
+	g_dc->Clear(D2D1::ColorF(0, 0, 0, 0));
+	g_dc->SetTransform(D2D1::Matrix3x2F::Translation(-(FLOAT)layer.x, -(FLOAT)layer.y));
+	vector<const Command*> list(n);
+	for (uint32_t i = 0; i < n; ++i) list[i] = &g_cmds[i];
+	DrawCommandsD2D(list.data(), list.size());
+	bool ok = SUCCEEDED(g_dc->EndDraw());
+	g_dc->SetTransform(oldXf);
+	g_dc->SetTarget(nullptr);
+	
+	D2D1_MAPPED_RECT mapped{};
+	ok = ok && SUCCEEDED(cpu->CopyFromBitmap(nullptr, bmp, nullptr)) && SUCCEEDED(cpu->Map(D2D1_MAP_OPTIONS_READ, &mapped));
+	if (ok) {
+		// The bytes go through QOI untouched, so premultiplied BGRA comes back exactly.
+		ImageView img;
+		img.data = mapped.bits;
+		img.stride = (ptrdiff_t)mapped.pitch;
+		img.w = layer.w;
+		img.h = layer.h;
+		img.channels = 4;
+		ok = EncodeQOI(img, layer.qoi);
+		cpu->Unmap();
+	}
+	SafeRelease(cpu);
+	if (ok) layer.bmp = bmp;
+	else SafeRelease(bmp);
+	return ok;
+}
+static void FlattenPrefix(uint32_t n) {
+	D2D1_RECT_F u{ 0, 0, -1, -1 };
+	for (uint32_t i = 0; i < n; ++i) {
+		D2D1_RECT_F b = CommandBounds(g_cmds[i]);
+		if (b.right < b.left) continue;
+		if (u.right < u.left) u = b;
+		else u = D2D1::RectF(min(u.left, b.left), min(u.top, b.top), max(u.right, b.right), max(u.bottom, b.bottom));
+	}
+	// Ink off the overlay is never seen, so the layer is cropped to it.
+	const int x0 = max(0, (int)std::floor(u.left)), y0 = max(0, (int)std::floor(u.top));
+	const int x1 = min(g_w, (int)std::ceil(u.right)), y1 = min(g_h, (int)std::ceil(u.bottom));
+	vector<Command> prefix;
+	vector<uint32_t> gone(n), added;
+	for (uint32_t i = 0; i < n; ++i) gone[i] = i;
+	if (u.right >= u.left && x1 > x0 && y1 > y0) {
+		auto layer = std::make_shared<RasterLayer>();
+		layer->x = x0;
+		layer->y = y0;
+		layer->w = x1 - x0;
+		layer->h = y1 - y0;
+		if (!RenderRasterLayer(*layer, n)) return;
+		Command flat;
+		flat.type = CmdType::Raster;
+		flat.raster = std::move(layer);
+		prefix.push_back(std::move(flat));
+		added.push_back(0);
+	}
+	ReplaceSealedPrefix(n, prefix, gone, added, true);
+	ResetPointArena();
+}
+static void FlattenIfDue() {
+	if (g_flattenMB <= 0 || g_compactBusy || g_drawing || g_replaying || !g_dc) return;
+	const uint32_t n = (uint32_t)SealedPrefix();
+	size_t bytes = 0;
+	for (uint32_t i = 0; i < n; ++i)
+		if (g_cmds[i].type != CmdType::Raster) bytes += CommandBytes(g_cmds[i]) + g_cmds[i].pts.size() * sizeof(D2D1_POINT_2F);
+	if (bytes > ((size_t)g_flattenMB << 20)) FlattenPrefix(n);
+}
+
+// WM_APP_COMPACTED handler.
+static void OnCompactionDone() {
+	if (g_compactThread.joinable()) g_compactThread.join();
+	g_compactBusy = false;
+	ApplyCompaction();
+	FlattenIfDue();
 }
 
 // ---------- Click-through ----------
@@ -1471,9 +4944,10 @@ static void ToggleOverlay() {
 		else g_prevMode = UIMode::Draw;
 		if (g_drawing) {
 			g_drawing = false;
-			if (!g_live.pts.empty()) {
-				g_cmds.push_back(g_live);
-				while (!g_redo.empty()) g_redo.pop();
+			if (g_objErasing) FinishObjectErase();
+			else if (!g_live.pts.empty()) {
+				CommitCommand(std::move(g_live));
+				g_live = Command{};
 			}
 			ReleaseCapture();
 			RepaintContent();
@@ -1623,227 +5097,1008 @@ static void ResizeToVirtualDesktop() {
 	if (w > 0 && h > 0 && (w != g_w || h != g_h)) {
 		g_w = w;
 		g_h = h;
-		ResizeSwapChain(w, h);
+		BuildSurfaces();
+		ResetContentTiles();
 		RepaintContent();
 		RenderFrame(false);
+	} else if (g_dcomp && !SurfacesMatch(MonitorRects())) {
+		// Same bounding box, different arrangement (a monitor moved or changed mode).
+		BuildSurfaces();
+		RenderFrame(false);
 	}
 }
 
-// ---------- Screenshot (non-blocking PNG encode) ----------
-static void PostSavedDone(bool ok) {
-	PostMessageW(g_hwnd, WM_APP_SAVEDONE, ok ? 1 : 0, 0);
+// ---------- Capture buffer pool ----------
+// Screenshots BitBlt straight into pooled DIB sections backed by page-aligned pagefile
+// sections; the pixel pass runs in place and the encoder reads the same memory, so a capture
+// is never copied. g_ssPoolSlots slots stay allocated between captures; when they are all
+// busy a spare slot is added, and its memory is freed on release. Peak memory is bounded by
+// SCREENSHOT_QUEUE_MB instead (see ShotQueueFull).
+struct CaptureSlot {
+	HANDLE       section = nullptr;
+	size_t       capacity = 0;
+	HBITMAP      dib = nullptr;
+	BYTE*        bits = nullptr;
+	int          dibW = 0, dibH = 0; // size the DIB was created at
+	int          w = 0, h = 0;       // size of the current capture; annotation exports set it
+	                                 // without reshaping the DIB, so it says nothing about `dib`
+	vector<BYTE> overlay;
+	bool         inUse = false;
+	bool         spare = false;      // beyond SCREENSHOT_BUFFERS: memory is freed on release
+};
+
+std::mutex                g_poolMutex;
+std::deque<CaptureSlot>   g_pool;   // a deque, so queued jobs' slot pointers survive growth
+size_t g_poolBytes = 0, g_poolPeakBytes = 0, g_poolCaptures = 0, g_poolRefused = 0, g_poolPeakBusy = 0;
+
+static size_t CapturePoolBytesLocked() {
+	size_t total = 0;
+	for (const CaptureSlot& s : g_pool) total += s.capacity + s.overlay.capacity();
+	return total;
 }
-static void PostAreaSavedDone(bool ok) {
-	PostMessageW(g_hwnd, WM_APP_AREASAVEDONE, ok ? 1 : 0, 0);
+static void NoteCapturePoolUsage() {
+	std::lock_guard<std::mutex> lock(g_poolMutex);
+	g_poolBytes = CapturePoolBytesLocked();
+	g_poolPeakBytes = max(g_poolPeakBytes, g_poolBytes);
 }
-
-static bool TakeScreenshotAsync() {
-	if (!g_wic || !g_dc) return false;
-	if (g_ssBusy.exchange(true)) return false;
-	
-	int vw = g_w, vh = g_h;
-	if (vw <= 0 || vh <= 0) {
-		g_ssBusy = false;
+static void FreeCaptureSlotMemory(CaptureSlot& s) {
+	if (s.dib) DeleteObject(s.dib);
+	if (s.section) CloseHandle(s.section);
+	s.dib = nullptr;
+	s.section = nullptr;
+	s.bits = nullptr;
+	s.capacity = 0;
+	s.dibW = s.dibH = 0;
+}
+static bool SlotDibIs(const CaptureSlot& s, int w, int h) {
+	return s.dib && s.dibW == w && s.dibH == h;
+}
+// Re-points the slot's DIB at w x h, growing the backing section only when it is too small.
+static bool ShapeCaptureSlot(CaptureSlot& s, int w, int h) {
+	if (SlotDibIs(s, w, h)) return true;
+	const size_t need = ((size_t)w * h * 4 + 0xFFFF) & ~(size_t)0xFFFF;
+	if (s.dib) DeleteObject(s.dib);
+	s.dib = nullptr;
+	s.bits = nullptr;
+	if (s.capacity < need) {
+		if (s.section) CloseHandle(s.section);
+		s.section = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)need >> 32), (DWORD)need, nullptr);
+		s.capacity = s.section ? need : 0;
+		if (!s.section) return false;
+	}
+	BITMAPINFO bi{};
+	bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bi.bmiHeader.biWidth = w;
+	bi.bmiHeader.biHeight = -h;
+	bi.bmiHeader.biPlanes = 1;
+	bi.bmiHeader.biBitCount = 32;
+	bi.bmiHeader.biCompression = BI_RGB;
+	void* bits = nullptr;
+	s.dib = CreateDIBSection(nullptr, &bi, DIB_RGB_COLORS, &bits, s.section, 0);
+	if (!s.dib || !bits) {
+		FreeCaptureSlotMemory(s);
 		return false;
 	}
+	s.bits = (BYTE*)bits;
+	s.dibW = w;
+	s.dibH = h;
+	return true;
+}
+static CaptureSlot* AcquireCaptureSlot(int w, int h, bool needDib) {
+	std::lock_guard<std::mutex> lock(g_poolMutex);
+	const size_t need = (size_t)w * h * 4;
+	CaptureSlot* pick = nullptr;
+	for (CaptureSlot& s : g_pool) {
+		if (s.inUse) continue;
+		if (SlotDibIs(s, w, h)) {
+			pick = &s;
+			break;
+		}
+		if (!pick || (s.capacity >= need && pick->capacity < need)) pick = &s;
+	}
+	if (!pick) {
+		g_pool.emplace_back();
+		pick = &g_pool.back();
+		pick->spare = g_pool.size() > (size_t)max(1, g_ssPoolSlots);
+	}
+	if (needDib && !ShapeCaptureSlot(*pick, w, h)) return nullptr;
+	pick->w = w;
+	pick->h = h;
+	pick->inUse = true;
+	++g_poolCaptures;
+	size_t busy = 0;
+	for (const CaptureSlot& s : g_pool) busy += s.inUse ? 1 : 0;
+	g_poolPeakBusy = max(g_poolPeakBusy, busy);
+	g_poolBytes = CapturePoolBytesLocked();
+	g_poolPeakBytes = max(g_poolPeakBytes, g_poolBytes);
+	return pick;
+}
+static void ReleaseCaptureSlot(CaptureSlot* slot) {
+	std::lock_guard<std::mutex> lock(g_poolMutex);
+	slot->inUse = false;
+	if (slot->spare) {
+		FreeCaptureSlotMemory(*slot);
+		vector<BYTE>().swap(slot->overlay);
+	}
+}
+static void FreeCapturePool() {
+	std::lock_guard<std::mutex> lock(g_poolMutex);
+	for (CaptureSlot& s : g_pool) if (!s.inUse) {
+		FreeCaptureSlotMemory(s);
+		vector<BYTE>().swap(s.overlay);
+	}
+	g_poolBytes = CapturePoolBytesLocked();
+}
+
+// Composition over the annotation layer and the 3-byte pack run in place, in one pass; the
+// returned view points into the slot's own memory.
+static ImageView PackCaptureSlot(CaptureSlot* slot, bool compose, unsigned pack) {
+	const int w = slot->w, h = slot->h;
+	PixelJob job;
+	job.src = slot->bits;
+	job.srcStride = (ptrdiff_t)w * 4;
+	job.dst = slot->bits;
+	job.dstStride = (ptrdiff_t)w * 3;
+	job.w = w;
+	job.h = h;
+	job.ops = pack;
+	if (compose) {
+		job.overlay = slot->overlay.data();
+		job.overlayStride = (ptrdiff_t)w * 4;
+		job.ops |= PX_COMPOSE;
+	}
+	RunPixelJob(job);
+	ImageView img;
+	img.data = slot->bits;
+	img.stride = job.dstStride;
+	img.w = w;
+	img.h = h;
+	return img;
+}
+
+// ---------- Screenshot pipeline ----------
+// Captures are taken on the UI thread (the BitBlt and the overlay readback need it) and then
+// flow through persistent stages: compose (pixel pass), encode (a small worker pool) and
+// write (one thread, so disk I/O stays sequential). Queues are unbounded; the backpressure is
+// SCREENSHOT_QUEUE_MB, checked before a capture is taken, so the UI thread never waits on a
+// stage. Each finished job posts WM_APP_SAVEDONE with its id.
+enum class ShotKind { Screen, Area, Ink };
+struct ShotJob {
+	uint32_t           id = 0;
+	ShotKind           kind = ShotKind::Screen;
+	CaptureSlot*       slot = nullptr;
+	bool               compose = false;
+	const ImageFormat* fmt = nullptr;
+	wstring            path;
+	ImageView          img;
+	vector<uint8_t>    bytes;
+	vector<uint8_t>    scaled, thumb;   // SCREENSHOT_SCALE / SCREENSHOT_THUMBNAIL pixels
+	ImageView          thumbImg;
+	vector<uint8_t>    thumbBytes;
+	bool               ok = true;
+};
+struct ShotQueue {
+	std::mutex              m;
+	std::condition_variable cv;
+	std::deque<ShotJob*>    q;
+	bool                    closed = false;
+	void Push(ShotJob* j) {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			q.push_back(j);
+		}
+		cv.notify_one();
+	}
+	// Blocks until a job arrives; returns nullptr once closed and drained.
+	ShotJob* Pop() {
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait(lock, [this] { return closed || !q.empty(); });
+		if (q.empty()) return nullptr;
+		ShotJob* j = q.front();
+		q.pop_front();
+		return j;
+	}
+	void Close() {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			closed = true;
+		}
+		cv.notify_all();
+	}
+};
+struct ShotTicket {
+	ShotKind kind;
+	bool     oneMonitor;   // toast only on toastMon
+	RECT     toastMon;
+	size_t   bytes;        // ShotFootprint, charged until WM_APP_SAVEDONE
+};
+
+ShotQueue           g_composeQ, g_encodeQ, g_writeQ;
+vector<std::thread> g_composeWorkers, g_encodeWorkers, g_writeWorkers;
+map<uint32_t, ShotTicket> g_shotTickets;   // UI thread only
+uint32_t            g_nextShotId = 1;
+std::atomic<size_t> g_shotsSaved{0}, g_shotsFailed{0};
+
+// Each job is charged for its capture and its overlay readback (or the encoded file, which is
+// smaller) until it has been written, so output waiting on a slow disk stays bounded as well.
+static size_t ShotFootprint(int w, int h) {
+	return (size_t)w * h * 8;
+}
+
+// In-place premultiplied BGRA -> straight RGBA, for the transparent annotation export.
+static void UnpremultiplyBGRAToRGBA(uint8_t* p, size_t pixels) {
+	for (size_t i = 0; i < pixels; ++i, p += 4) {
+		const uint32_t a = p[3];
+		uint8_t b = p[0], g = p[1], r = p[2];
+		if (a && a != 255) {
+			b = (uint8_t)min(255u, (b * 255u + a / 2) / a);
+			g = (uint8_t)min(255u, (g * 255u + a / 2) / a);
+			r = (uint8_t)min(255u, (r * 255u + a / 2) / a);
+		}
+		p[0] = r;
+		p[1] = g;
+		p[2] = b;
+	}
+}
+
+// Packs a tightly laid out 4-byte buffer to 3 bytes per pixel in place.
+static ImageView PackBGRAInPlace(uint8_t* p, int w, int h, unsigned pack) {
+	PixelJob job;
+	job.src = p;
+	job.srcStride = (ptrdiff_t)w * 4;
+	job.dst = p;
+	job.dstStride = (ptrdiff_t)w * 3;
+	job.w = w;
+	job.h = h;
+	job.ops = pack;
+	RunPixelJob(job);
+	ImageView img;
+	img.data = p;
+	img.stride = job.dstStride;
+	img.w = w;
+	img.h = h;
+	return img;
+}
+// Composes in place at full size, then box-filters down to the output scale and/or the
+// thumbnail width before packing. A scaled job no longer needs its slot, so it is returned
+// here rather than after encoding.
+static void ComposeScaledShot(ShotJob* j) {
+	CaptureSlot* s = j->slot;
+	int w = s->w, h = s->h;
+	if (j->compose) {
+		PixelJob job;
+		job.src = s->bits;
+		job.srcStride = (ptrdiff_t)w * 4;
+		job.overlay = s->overlay.data();
+		job.overlayStride = (ptrdiff_t)w * 4;
+		job.dst = s->bits;
+		job.dstStride = (ptrdiff_t)w * 4;
+		job.w = w;
+		job.h = h;
+		job.ops = PX_COMPOSE;
+		RunPixelJob(job);
+	}
+	uint8_t* base = s->bits;
+	if (g_ssScalePct < 100) {
+		const int dw = max(1, w * g_ssScalePct / 100), dh = max(1, h * g_ssScalePct / 100);
+		j->scaled.resize((size_t)dw * dh * 4);
+		ResampleBox(s->bits, (ptrdiff_t)w * 4, w, h, j->scaled.data(), (ptrdiff_t)dw * 4, dw, dh);
+		base = j->scaled.data();
+		w = dw;
+		h = dh;
+	}
+	if (g_ssThumbWidth > 0) {
+		const int tw = min(w, g_ssThumbWidth), th = max(1, (int)((int64_t)h * tw / w));
+		j->thumb.resize((size_t)tw * th * 4);
+		ResampleBox(base, (ptrdiff_t)w * 4, w, h, j->thumb.data(), (ptrdiff_t)tw * 4, tw, th);
+		j->thumbImg = PackBGRAInPlace(j->thumb.data(), tw, th, j->fmt->pack);
+	}
+	j->img = PackBGRAInPlace(base, w, h, j->fmt->pack);
+	if (base != s->bits) {
+		ReleaseCaptureSlot(s);
+		j->slot = nullptr;
+	}
+}
+static void ShotComposeStage() {
+	while (ShotJob* j = g_composeQ.Pop()) {
+		if (j->kind == ShotKind::Ink) {
+			CaptureSlot* s = j->slot;
+			UnpremultiplyBGRAToRGBA(s->overlay.data(), (size_t)s->w * s->h);
+			j->img.data = s->overlay.data();
+			j->img.stride = (ptrdiff_t)s->w * 4;
+			j->img.w = s->w;
+			j->img.h = s->h;
+			j->img.channels = 4;
+		} else if (g_ssScalePct < 100 || g_ssThumbWidth > 0) ComposeScaledShot(j);
+		else j->img = PackCaptureSlot(j->slot, j->compose, j->fmt->pack);
+		g_encodeQ.Push(j);
+	}
+}
+static void ShotEncodeStage() {
+	while (ShotJob* j = g_encodeQ.Pop()) {
+		j->ok = j->fmt->encode(j->img, j->bytes);
+		if (j->ok && j->thumbImg.data && !j->fmt->encode(j->thumbImg, j->thumbBytes)) j->thumbBytes.clear();
+		if (j->slot) ReleaseCaptureSlot(j->slot);
+		j->slot = nullptr;
+		g_writeQ.Push(j);
+	}
+}
+static void ShotWriteStage() {
+	while (ShotJob* j = g_writeQ.Pop()) {
+		bool ok = j->ok && WriteBytesToNewFile(j->path, j->bytes);
+		if (ok && !j->thumbBytes.empty()) {
+			const size_t dot = j->path.find_last_of(L'.');
+			wstring thumbPath = j->path.substr(0, dot) + L"_thumb" + j->path.substr(dot);
+			WriteBytesToNewFile(thumbPath, j->thumbBytes);
+		}
+		++(ok ? g_shotsSaved : g_shotsFailed);
+		PostMessageW(g_hwnd, WM_APP_SAVEDONE, ok ? 1 : 0, (LPARAM)j->id);
+		delete j;
+	}
+}
+static void StartShotPipeline() {
+	if (!g_composeWorkers.empty()) return;
+	g_composeWorkers.emplace_back(ShotComposeStage);
+	for (int i = 0; i < g_ssEncoders; ++i) g_encodeWorkers.emplace_back(ShotEncodeStage);
+	g_writeWorkers.emplace_back(ShotWriteStage);
+}
+// Lets every queued job finish (stage by stage) and joins the workers.
+static void StopShotPipeline() {
+	g_composeQ.Close();
+	for (auto& t : g_composeWorkers) t.join();
+	g_encodeQ.Close();
+	for (auto& t : g_encodeWorkers) t.join();
+	g_writeQ.Close();
+	for (auto& t : g_writeWorkers) t.join();
+	g_composeWorkers.clear();
+	g_encodeWorkers.clear();
+	g_writeWorkers.clear();
+}
+static void SubmitShot(ShotKind kind, CaptureSlot* slot, bool compose, const ImageFormat& fmt, const wchar_t* tag, const RECT* toastMon = nullptr) {
+	StartShotPipeline();
+	ShotJob* j = new ShotJob();
+	j->id = g_nextShotId++;
+	j->kind = kind;
+	j->slot = slot;
+	j->compose = compose;
+	j->fmt = &fmt;
+	j->path = BuildTimestampedPath(g_screenshotDir, tag, fmt.ext);
+	EnsureDirectoryExists(g_screenshotDir);
+	g_shotTickets[j->id] = ShotTicket{ kind, toastMon != nullptr, toastMon ? *toastMon : RECT{}, ShotFootprint(slot->w, slot->h) };
+	g_composeQ.Push(j);
+}
+// A w x h capture is refused only when earlier jobs already hold SCREENSHOT_QUEUE_MB; the
+// first one always goes through, however large the desktop.
+static bool ShotQueueFull(int w, int h) {
+	size_t held = 0;
+	for (const auto& t : g_shotTickets) held += t.second.bytes;
+	return held && held + ShotFootprint(w, h) > ((size_t)g_ssQueueMB << 20);
+}
+static void ShowShotRefused() {
+	{
+		std::lock_guard<std::mutex> lock(g_poolMutex);
+		++g_poolRefused;
+	}
+	ShowToast(L"Screenshot queue full.");
+	RenderFrame(false);
+}
+// WM_APP_SAVEDONE handler.
+static void OnShotDone(bool ok, uint32_t id) {
+	auto it = g_shotTickets.find(id);
+	if (it == g_shotTickets.end()) return;
+	ShotTicket t = it->second;
+	g_shotTickets.erase(it);
 	
-	HDC sdc = GetDC(nullptr);
-	if (!sdc) {
-		g_ssBusy = false;
-		return false;
+	wchar_t msg[96];
+	const wchar_t* what = t.kind == ShotKind::Ink ? L"Annotations" : L"Screenshot";
+	if (!ok) swprintf(msg, 96, L"%ls not saved.", what);
+	else if (!g_shotTickets.empty()) swprintf(msg, 96, L"%ls Saved. (%d pending)", what, (int)g_shotTickets.size());
+	else swprintf(msg, 96, L"%ls Saved.", what);
+	if (t.oneMonitor) ShowToastOnMonitor(msg, t.toastMon);
+	else ShowToast(msg);
+	RenderFrame(false);
+}
+
+// WDA_EXCLUDEFROMCAPTURE needs Windows 10 2004; older builds treat it as WDA_MONITOR and
+// would black out the whole overlay in the capture instead.
+static bool CanExcludeOverlayFromCapture() {
+	static int cached = -1;
+	if (cached < 0) {
+		cached = 0;
+		typedef LONG (WINAPI *PFN_RtlGetVersion)(OSVERSIONINFOW*);
+		if (HMODULE hNt = GetModuleHandleW(L"ntdll.dll")) {
+			if (auto pGetVersion = (PFN_RtlGetVersion)GetProcAddress(hNt, "RtlGetVersion")) {
+				OSVERSIONINFOW vi{};
+				vi.dwOSVersionInfoSize = sizeof(vi);
+				if (pGetVersion(&vi) == 0 && (vi.dwMajorVersion > 10 || (vi.dwMajorVersion == 10 && vi.dwBuildNumber >= 19041))) cached = 1;
+			}
+		}
 	}
+	return cached == 1;
+}
+
+// Grabs screen rect `src` into the slot's DIB. When possible the overlay is hidden from this
+// one grab, so annotations come from the content layer (without the size indicator or
+// toast); `overlayHidden` reports whether that happened.
+static bool CaptureScreenToSlot(const RECT& src, CaptureSlot* slot, bool& overlayHidden) {
+	overlayHidden = false;
+	HDC sdc = GetDC(nullptr);
+	if (!sdc) return false;
 	HDC mdc = CreateCompatibleDC(sdc);
 	if (!mdc) {
 		ReleaseDC(nullptr, sdc);
-		g_ssBusy = false;
 		return false;
 	}
+	HGDIOBJ old = SelectObject(mdc, slot->dib);
+	// The timelapse thread captures too; one affinity toggle at a time.
+	static std::mutex affinityMutex;
+	std::lock_guard<std::mutex> lock(affinityMutex);
+	if (CanExcludeOverlayFromCapture() && SetWindowDisplayAffinity(g_hwnd, WDA_EXCLUDEFROMCAPTURE)) {
+		overlayHidden = true;
+		DwmFlush();
+	}
+	BOOL ok = BitBlt(mdc, 0, 0, slot->w, slot->h, sdc, src.left, src.top, SRCCOPY | CAPTUREBLT);
+	if (overlayHidden) SetWindowDisplayAffinity(g_hwnd, WDA_NONE);
+	SelectObject(mdc, old);
+	DeleteDC(mdc);
+	ReleaseDC(nullptr, sdc);
+	return ok != FALSE;
+}
+
+static bool HasLiveAnnotation() {
+	return (g_drawing && g_live.type == CmdType::Stroke) || (g_textMode && !g_live.text.empty());
+}
+
+// Reads back the cached content tiles under client rect `rc` into `out` as tightly packed
+// premultiplied BGRA, with the live stroke or text on top. Committed commands are not replayed.
+// Returns false when there is nothing drawn.
+static bool ReadbackAnnotations(const RECT& rc, vector<BYTE>& out) {
+	if (!g_dc || g_tiles.empty()) return false;
+	const bool live = HasLiveAnnotation();
+	if (!g_tileCount && !live) return false;
 	
-	BITMAPINFO bi{};
-	bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-	bi.bmiHeader.biWidth = vw;
-	bi.bmiHeader.biHeight = -vh;
-	bi.bmiHeader.biPlanes = 1;
-	bi.bmiHeader.biBitCount = 32;
-	bi.bmiHeader.biCompression = BI_RGB;
+	const int w = rc.right - rc.left, h = rc.bottom - rc.top;
+	RECT clip{ max(0L, rc.left), max(0L, rc.top), min((LONG)g_w, rc.right), min((LONG)g_h, rc.bottom) };
+	if (w <= 0 || h <= 0 || clip.right <= clip.left || clip.bottom <= clip.top) return false;
+	const UINT32 cw = (UINT32)(clip.right - clip.left), ch = (UINT32)(clip.bottom - clip.top);
 	
-	void* dibBits = nullptr;
-	HBITMAP hbmp = CreateDIBSection(sdc, &bi, DIB_RGB_COLORS, &dibBits, nullptr, 0);
-	HGDIOBJ old = hbmp ? SelectObject(mdc, hbmp) : nullptr;
+	if (g_readbackBmp) {
+		D2D1_SIZE_U sz = g_readbackBmp->GetPixelSize();
+		if (sz.width != cw || sz.height != ch) SafeRelease(g_readbackBmp);
+	}
+	D2D1_BITMAP_PROPERTIES1 props{};
+	props.pixelFormat = {DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED};
+	props.dpiX = 96.f;
+	props.dpiY = 96.f;
+	if (!g_readbackBmp) {
+		props.bitmapOptions = D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW;
+		if (FAILED(g_dc->CreateBitmap(D2D1_SIZE_U{cw, ch}, nullptr, 0, &props, &g_readbackBmp))) return false;
+	}
 	
-	bool ok = false;
-	vector<BYTE> frame;
-	int stride = vw * 4;
+	// The tiles under the rect (and the live annotation) are composed into one bitmap first.
+	ID2D1Bitmap1* composed = nullptr;
+	props.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET;
+	if (FAILED(g_dc->CreateBitmap(D2D1_SIZE_U{cw, ch}, nullptr, 0, &props, &composed))) return false;
+	D2D1_MATRIX_3X2_F oldXf;
+	g_dc->GetTransform(&oldXf);
+	g_dc->SetTarget(composed);
+	g_dc->BeginDraw();
+	g_dc->Clear(D2D1::ColorF(0, 0, 0, 0));
+	DrawContentTiles(D2D1::RectF((FLOAT)clip.left, (FLOAT)clip.top, (FLOAT)clip.right, (FLOAT)clip.bottom));
+	if (live) {
+		g_dc->SetTransform(D2D1::Matrix3x2F::Translation(-(FLOAT)clip.left, -(FLOAT)clip.top));
+		if (g_drawing && g_live.type == CmdType::Stroke) DrawLiveStroke(false);
+		if (g_textMode) DrawLiveText();
+	}
+	g_dc->EndDraw();
+	g_dc->SetTransform(oldXf);
+	g_dc->SetTarget(nullptr);
+	D2D1_POINT_2U at{0, 0};
+	D2D1_RECT_U srcRect = D2D1::RectU(0, 0, cw, ch);
+	HRESULT hr = g_readbackBmp->CopyFromBitmap(&at, composed, &srcRect);
+	SafeRelease(composed);
+	if (FAILED(hr)) return false;
+	
+	D2D1_MAPPED_RECT mapped{};
+	if (FAILED(g_readbackBmp->Map(D2D1_MAP_OPTIONS_READ, &mapped))) return false;
+	out.assign((size_t)w * h * 4, 0);
+	for (UINT32 y = 0; y < ch; ++y) {
+		BYTE* d = &out[((size_t)(clip.top - rc.top + y) * w + (clip.left - rc.left)) * 4];
+		std::memcpy(d, mapped.bits + (size_t)y * mapped.pitch, (size_t)cw * 4);
+	}
+	g_readbackBmp->Unmap();
+	return true;
+}
+
+// `src` is in screen coordinates. Capture, overlay readback, composition and encoding all
+// cover just this rect.
+static CaptureSlot* CaptureRect(const RECT& src, bool& compose) {
+	compose = false;
+	if (!g_dc) return nullptr;
+	
+	int vw = src.right - src.left, vh = src.bottom - src.top;
+	if (vw <= 0 || vh <= 0) return nullptr;
+	
+	CaptureSlot* slot = ShotQueueFull(vw, vh) ? nullptr : AcquireCaptureSlot(vw, vh, true);
+	if (!slot) {
+		ShowShotRefused();
+		return nullptr;
+	}
+	bool overlayHidden = false;
+	if (!CaptureScreenToSlot(src, slot, overlayHidden)) {
+		ReleaseCaptureSlot(slot);
+		return nullptr;
+	}
+	
+	if (overlayHidden) {
+		RECT rc{ src.left - g_vx, src.top - g_vy, src.right - g_vx, src.bottom - g_vy };
+		compose = ReadbackAnnotations(rc, slot->overlay);
+		NoteCapturePoolUsage();
+	}
+	return slot;
+}
+static bool TakeRectScreenshotAsync(const RECT& src, ShotKind kind, const RECT* toastMon) {
+	bool compose = false;
+	CaptureSlot* slot = CaptureRect(src, compose);
+	if (!slot) return false;
+	SubmitShot(kind, slot, compose, ScreenshotFormat(), L"", toastMon);
+	return true;
+}
+// Monitor rect for SCREENSHOT_MODE; false means "whole virtual desktop".
+static bool ScreenshotMonitorRect(RECT& out) {
+	if (g_ssMode == SSMODE_DESKTOP) return false;
+	if (g_ssMode == SSMODE_CURSOR) {
+		POINT pt;
+		GetCursorPos(&pt);
+		MONITORINFO mi{ sizeof(mi) };
+		if (!GetMonitorInfo(MonitorFromPoint(pt, MONITOR_DEFAULTTONEAREST), &mi)) return false;
+		out = mi.rcMonitor;
+		return true;
+	}
+	struct MonCtx {
+		static BOOL CALLBACK CB(HMONITOR, HDC, LPRECT prc, LPARAM lp) {
+			((vector<RECT>*)lp)->push_back(*prc);
+			return TRUE;
+		}
+	};
+	vector<RECT> mons;
+	EnumDisplayMonitors(nullptr, nullptr, MonCtx::CB, (LPARAM)&mons);
+	if (g_ssMonitor < 1 || g_ssMonitor > (int)mons.size()) return false;
+	out = mons[g_ssMonitor - 1];
+	return true;
+}
+// Screen rect for a full screenshot; `mon` is set when it is a single monitor.
+static RECT FullScreenshotRect(bool& oneMonitor, RECT& mon) {
+	oneMonitor = false;
+	if (ScreenshotMonitorRect(mon)) {
+		RECT src{ max(mon.left, (LONG)g_vx), max(mon.top, (LONG)g_vy), min(mon.right, (LONG)(g_vx + g_w)), min(mon.bottom, (LONG)(g_vy + g_h)) };
+		if (src.right > src.left && src.bottom > src.top) {
+			oneMonitor = true;
+			return src;
+		}
+	}
+	return RECT{ g_vx, g_vy, g_vx + g_w, g_vy + g_h };
+}
+static bool CopyScreenshotToClipboard(const RECT& src, const RECT* toastMon);
+static bool TakeScreenshotAsync() {
+	bool oneMonitor = false;
+	RECT mon{};
+	RECT src = FullScreenshotRect(oneMonitor, mon);
+	return TakeRectScreenshotAsync(src, ShotKind::Screen, oneMonitor ? &mon : nullptr);
+}
+// Called when an area selection completes; Ctrl+X selections go to the clipboard.
+static bool TakeAreaScreenshotAsync(const RECT& src) {
+	RECT rc{ src.left, src.top, max(src.left + 1, src.right), max(src.top + 1, src.bottom) };
+	if (g_areaToClipboard) {
+		g_areaToClipboard = false;
+		return CopyScreenshotToClipboard(rc, &g_areaToastMonRect);
+	}
+	return TakeRectScreenshotAsync(rc, ShotKind::Area, &g_areaToastMonRect);
+}
+
+// Saves just the annotation layer (full overlay size) as a transparent PNG.
+static bool ExportAnnotationsAsync() {
+	if (!g_dc) return false;
+	
+	CaptureSlot* slot = ShotQueueFull(g_w, g_h) ? nullptr : AcquireCaptureSlot(g_w, g_h, false);
+	if (!slot) {
+		ShowShotRefused();
+		return false;
+	}
+	if (!ReadbackAnnotations(RECT{0, 0, g_w, g_h}, slot->overlay)) {
+		ReleaseCaptureSlot(slot);
+		return false;
+	}
+	NoteCapturePoolUsage();
+	
+	// Always the built-in PNG: it is the only format here that keeps the alpha channel.
+	SubmitShot(ShotKind::Ink, slot, false, g_imageFormats[0], L"_ink");
+	return true;
+}
+
+// ---------- Clipboard screenshots (delayed rendering) ----------
+// The capture (and its annotation readback) is kept in a pool slot and the clipboard only
+// gets format promises. Packing to a DIB, or encoding PNG, happens in WM_RENDERFORMAT when
+// an application actually pastes; WM_DESTROYCLIPBOARD returns the slot.
+CaptureSlot* g_clipSlot = nullptr;
+bool         g_clipCompose = false;
+UINT         g_cfPNG = 0;
+
+static void ReleaseClipboardShot() {
+	if (!g_clipSlot) return;
+	ReleaseCaptureSlot(g_clipSlot);
+	g_clipSlot = nullptr;
+}
+static HGLOBAL RenderClipboardFormat(UINT fmt) {
+	if (!g_clipSlot) return nullptr;
+	CaptureSlot* s = g_clipSlot;
+	PixelJob job;
+	job.src = s->bits;
+	job.srcStride = (ptrdiff_t)s->w * 4;
+	job.w = s->w;
+	job.h = s->h;
+	if (g_clipCompose) {
+		job.overlay = s->overlay.data();
+		job.overlayStride = (ptrdiff_t)s->w * 4;
+		job.ops |= PX_COMPOSE;
+	}
+	if (fmt == CF_DIB) {
+		// 24bpp bottom-up DIB: the pipeline writes rows in reverse through a negative stride.
+		const size_t stride = ((size_t)s->w * 3 + 3) & ~(size_t)3;
+		HGLOBAL mem = GlobalAlloc(GMEM_MOVEABLE | GMEM_ZEROINIT, sizeof(BITMAPINFOHEADER) + stride * s->h);
+		if (!mem) return nullptr;
+		BITMAPINFOHEADER* bih = (BITMAPINFOHEADER*)GlobalLock(mem);
+		bih->biSize = sizeof(BITMAPINFOHEADER);
+		bih->biWidth = s->w;
+		bih->biHeight = s->h;
+		bih->biPlanes = 1;
+		bih->biBitCount = 24;
+		bih->biCompression = BI_RGB;
+		bih->biSizeImage = (DWORD)(stride * s->h);
+		uint8_t* pixels = (uint8_t*)(bih + 1);
+		job.dst = pixels + stride * (s->h - 1);
+		job.dstStride = -(ptrdiff_t)stride;
+		job.ops |= PX_PACK_BGR;
+		RunPixelJob(job);
+		GlobalUnlock(mem);
+		return mem;
+	}
+	if (fmt == g_cfPNG) {
+		vector<uint8_t> rgb((size_t)s->w * 3 * s->h);
+		job.dst = rgb.data();
+		job.dstStride = (ptrdiff_t)s->w * 3;
+		job.ops |= PX_PACK_RGB;
+		RunPixelJob(job);
+		ImageView img;
+		img.data = rgb.data();
+		img.stride = job.dstStride;
+		img.w = s->w;
+		img.h = s->h;
+		vector<uint8_t> png;
+		if (!EncodePNG(img, g_pngLevel, png)) return nullptr;
+		HGLOBAL mem = GlobalAlloc(GMEM_MOVEABLE, png.size());
+		if (!mem) return nullptr;
+		memcpy(GlobalLock(mem), png.data(), png.size());
+		GlobalUnlock(mem);
+		return mem;
+	}
+	return nullptr;
+}
+static bool CopyScreenshotToClipboard(const RECT& src, const RECT* toastMon) {
+	if (!g_cfPNG) g_cfPNG = RegisterClipboardFormatW(L"PNG");
+	bool compose = false;
+	CaptureSlot* slot = CaptureRect(src, compose);
+	if (!slot) return false;
+	if (!OpenClipboard(g_hwnd)) {
+		ReleaseCaptureSlot(slot);
+		return false;
+	}
+	EmptyClipboard();   // WM_DESTROYCLIPBOARD releases the previous capture, if it was ours
+	ReleaseClipboardShot();
+	g_clipSlot = slot;
+	g_clipCompose = compose;
+	SetClipboardData(CF_DIB, nullptr);
+	SetClipboardData(g_cfPNG, nullptr);
+	CloseClipboard();
+	
+	if (toastMon) ShowToastOnMonitor(L"Copied to clipboard.", *toastMon);
+	else ShowToast(L"Copied to clipboard.");
+	RenderFrame(false);
+	return true;
+}
+static bool CopyFullScreenshotToClipboard() {
+	bool oneMonitor = false;
+	RECT mon{};
+	RECT src = FullScreenshotRect(oneMonitor, mon);
+	return CopyScreenshotToClipboard(src, oneMonitor ? &mon : nullptr);
+}
+// WM_RENDERALLFORMATS, and on exit while we still own the clipboard: render for real so the
+// data outlives the process.
+static void RenderAllClipboardFormats(bool open) {
+	if (!g_clipSlot) return;
+	if (open && !OpenClipboard(g_hwnd)) return;
+	if (GetClipboardOwner() == g_hwnd) {
+		if (HGLOBAL dib = RenderClipboardFormat(CF_DIB)) SetClipboardData(CF_DIB, dib);
+		if (HGLOBAL png = RenderClipboardFormat(g_cfPNG)) SetClipboardData(g_cfPNG, png);
+	}
+	if (open) CloseClipboard();
+}
+
+// ---------- Timelapse (interval capture) ----------
+// A background thread grabs the screenshot rect every TIMELAPSE_INTERVAL seconds into its own
+// capture slot and hashes 64x64 tiles of the raw grab. A frame whose tiles all match the last
+// written frame, with unchanged annotations, is skipped. Changed frames are composed, encoded
+// and written by the same thread into a per-session folder. The UI thread only does the
+// annotation readback, and only when g_contentVersion moved since the last frame.
+// The request is shared with the handler: a timed-out SendMessageTimeout is still delivered
+// later, so the worker marks it cancelled and lets the handler drop the last reference.
+static const UINT WM_APP_TLREADBACK = WM_APP + 102;   // lParam = new shared_ptr<TimelapseReadback>
+static const UINT WM_APP_TLSTOPPED  = WM_APP + 103;
+struct TimelapseReadback {
+	RECT              rc{};    // client coordinates
+	vector<BYTE>      out;
+	bool              ok = false;
+	std::atomic<bool> cancelled{ false };
+};
+
+std::thread             g_tlThread;
+std::mutex              g_tlMutex;
+std::condition_variable g_tlCv;
+bool                    g_tlStop = false;
+bool                    g_tlRunning = false;   // UI thread
+std::atomic<size_t>     g_tlFrames{0}, g_tlSkipped{0};
+
+static uint64_t HashTile(const uint8_t* p, ptrdiff_t stride, int w, int h) {
+	uint64_t hash = 0x9E3779B97F4A7C15ull;
+	const size_t n = (size_t)w * 4;
+	for (int y = 0; y < h; ++y, p += stride) {
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			uint64_t v;
+			memcpy(&v, p + i, 8);
+			hash = (hash ^ v) * 0x100000001B3ull;
+			hash ^= hash >> 29;
+		}
+		if (i < n) {
+			uint32_t v;
+			memcpy(&v, p + i, 4);
+			hash = (hash ^ v) * 0x100000001B3ull;
+		}
+	}
+	return hash;
+}
+static void HashTiles(const CaptureSlot& s, vector<uint64_t>& out) {
+	const int T = 64;
+	out.clear();
+	for (int ty = 0; ty < s.h; ty += T)
+		for (int tx = 0; tx < s.w; tx += T)
+			out.push_back(HashTile(s.bits + ((size_t)ty * s.w + tx) * 4, (ptrdiff_t)s.w * 4, min(T, s.w - tx), min(T, s.h - ty)));
+}
+
+static void TimelapseWorker(RECT src, wstring folder, int intervalMs, const ImageFormat* fmt) {
+	const int w = src.right - src.left, h = src.bottom - src.top;
+	const RECT client{ src.left - g_vx, src.top - g_vy, src.right - g_vx, src.bottom - g_vy };
+	const ULONGLONG t0 = GetTickCount64();
+	CaptureSlot slot;
+	vector<uint64_t> last, cur;
+	uint32_t overlayVersion = 0;
+	bool haveOverlay = false, compose = false;
 	
-	if (hbmp && dibBits) {
-		BitBlt(mdc, 0, 0, vw, vh, sdc, g_vx, g_vy, SRCCOPY | CAPTUREBLT);
-		
-		frame.resize((size_t)stride * vh);
-		const BYTE* src = (const BYTE*)dibBits;
-		for (int y = 0; y < vh; ++y) {
-			UINT32* d = (UINT32*)(&frame[(size_t)y * stride]);
-			const UINT32* s = (const UINT32*)(src + (size_t)y * vw * 4);
-			for (int x = 0; x < vw; ++x) d[x] = s[x] | 0xFF000000u;
+	std::unique_lock<std::mutex> lock(g_tlMutex);
+	while (!g_tlStop) {
+		lock.unlock();
+		bool hidden = false;
+		if (ShapeCaptureSlot(slot, w, h)) {
+			slot.w = w;
+			slot.h = h;
 		}
-		
-		IWICBitmap* wicMem = nullptr;
-		if (SUCCEEDED(g_wic->CreateBitmapFromMemory(vw, vh, GUID_WICPixelFormat32bppPBGRA, stride, (UINT)frame.size(), frame.data(), &wicMem))) {
-			D2D1_BITMAP_PROPERTIES1 props{};
-			props.pixelFormat = { DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED };
-			props.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET;
-			ID2D1Bitmap1* targetBmp = nullptr;
-			if (SUCCEEDED(g_dc->CreateBitmapFromWicBitmap(wicMem, &props, &targetBmp)) && targetBmp) {
-				g_dc->SetTarget(targetBmp);
-				g_dc->BeginDraw();
-				for (const auto& c : g_cmds) {
-					if (c.type == CmdType::Stroke) DrawStrokeD2D(c);
-					else DrawTextD2D(c);
-				}
-				if (g_drawing && g_live.type == CmdType::Stroke) DrawStrokeD2D(g_live);
-				if (g_textMode && !g_live.text.empty()) {
-					Command t = g_live;
-					t.type = CmdType::Text;
-					DrawTextD2D(t);
-				}
-				g_dc->EndDraw();
-				g_dc->SetTarget(g_target);
-				SafeRelease(targetBmp);
+		if (slot.dib && CaptureScreenToSlot(src, &slot, hidden)) {
+			bool overlayChanged = false;
+			const uint32_t v = g_contentVersion.load();
+			if (hidden && (!haveOverlay || v != overlayVersion)) {
+				auto rb = std::make_shared<TimelapseReadback>();
+				rb->rc = client;
+				DWORD_PTR res = 0;
+				if (SendMessageTimeoutW(g_hwnd, WM_APP_TLREADBACK, 0, (LPARAM)new std::shared_ptr<TimelapseReadback>(rb), SMTO_ABORTIFHUNG, 1000, &res)) {
+					slot.overlay.swap(rb->out);
+					haveOverlay = true;
+					overlayVersion = v;
+					overlayChanged = true;
+					compose = rb->ok;
+				} else rb->cancelled = true;
 			}
-			SafeRelease(wicMem);
+			HashTiles(slot, cur);
+			if (overlayChanged || cur != last) {
+				last.swap(cur);
+				ImageView img = PackCaptureSlot(&slot, compose, fmt->pack);
+				vector<uint8_t> bytes;
+				wchar_t name[64];
+				swprintf(name, 64, L"\\frame_%05u_%06us", (unsigned)g_tlFrames.load() + 1, (unsigned)((GetTickCount64() - t0) / 1000));
+				wstring path = folder + name + fmt->ext;
+				if (fmt->encode(img, bytes) && WriteBytesToNewFile(path, bytes)) ++g_tlFrames;
+			} else ++g_tlSkipped;
 		}
-		
-		ok = true;
+		lock.lock();
+		g_tlCv.wait_for(lock, std::chrono::milliseconds(intervalMs), [] { return g_tlStop; });
 	}
-	
-	if (old) SelectObject(mdc, old);
-	if (hbmp) DeleteObject(hbmp);
-	DeleteDC(mdc);
-	ReleaseDC(nullptr, sdc);
-	
-	if (!ok) {
-		g_ssBusy = false;
-		return false;
+	lock.unlock();
+	FreeCaptureSlotMemory(slot);
+	PostMessageW(g_hwnd, WM_APP_TLSTOPPED, 0, 0);
+}
+// Asks the worker to finish; WM_APP_TLSTOPPED joins it. `wait` joins right away (exit path).
+static void StopTimelapse(bool wait) {
+	{
+		std::lock_guard<std::mutex> lock(g_tlMutex);
+		g_tlStop = true;
 	}
+	g_tlCv.notify_all();
+	if (wait && g_tlThread.joinable()) g_tlThread.join();
+}
+static void ToggleTimelapse() {
+	if (g_tlRunning) {
+		g_tlRunning = false;
+		StopTimelapse(false);
+		return;
+	}
+	if (g_tlThread.joinable()) return;   // previous session still finishing
+	bool oneMonitor = false;
+	RECT mon{};
+	RECT src = FullScreenshotRect(oneMonitor, mon);
+	wstring folder = BuildTimestampedPath(g_screenshotDir, L"_timelapse", L"");
+	EnsureDirectoryExists(folder);
+	g_tlStop = false;
+	g_tlFrames = 0;
+	g_tlSkipped = 0;
+	g_tlRunning = true;
+	g_tlThread = std::thread(TimelapseWorker, src, folder, g_tlIntervalSec * 1000, &ScreenshotFormat());
 	
-	wstring path = BuildTimestampedPath(g_screenshotDir);
-	EnsureDirectoryExists(g_screenshotDir);
-	
-	std::thread([path = std::move(path), w = vw, h = vh, stride, data = std::move(frame)]() mutable {
-		CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-		bool okWrite = SavePNGFromMemoryToFile(path.c_str(), w, h, stride, data.data());
-		CoUninitialize();
-		g_ssBusy = false;
-		PostSavedDone(okWrite);
-	}).detach();
-	
-	return true;
+	wchar_t msg[64];
+	swprintf(msg, 64, L"Timelapse started (every %d s).", g_tlIntervalSec);
+	ShowToast(msg);
+	RenderFrame(false);
+}
+static void OnTimelapseStopped() {
+	if (g_tlThread.joinable()) g_tlThread.join();
+	g_tlRunning = false;
+	wchar_t msg[96];
+	swprintf(msg, 96, L"Timelapse stopped: %u frames, %u unchanged skipped.", (unsigned)g_tlFrames.load(), (unsigned)g_tlSkipped.load());
+	ShowToast(msg);
+	RenderFrame(false);
 }
 
-static bool TakeAreaScreenshotAsync(const RECT& src) {
-	if (!g_wic || !g_dc) return false;
-	if (g_ssBusy.exchange(true)) return false;
-	
-	int vw = max(1l, src.right - src.left);
-	int vh = max(1l, src.bottom - src.top);
-	if (vw <= 0 || vh <= 0) {
-		g_ssBusy = false;
-		return false;
+// ---------- Board save/load commands ----------
+static bool PickBoardPath(bool save, wstring& path) {
+	wstring dir = g_screenshotDir.empty() ? GetDefaultPicturesDir() : g_screenshotDir;
+	if (!dir.empty() && dir.back() != L'\\' && dir.back() != L'/') dir += L'\\';
+	dir += L"Easy Draw Boards";
+	SHCreateDirectoryExW(nullptr, dir.c_str(), nullptr);
+	wchar_t file[MAX_PATH] = L"";
+	if (save) {
+		SYSTEMTIME st;
+		GetLocalTime(&st);
+		swprintf(file, MAX_PATH, L"board_%04d%02d%02d_%02d%02d", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute);
 	}
-	
-	HDC sdc = GetDC(nullptr);
-	if (!sdc) {
-		g_ssBusy = false;
-		return false;
+	OPENFILENAMEW ofn{};
+	ofn.lStructSize = sizeof(ofn);
+	ofn.hwndOwner = g_hwnd;
+	ofn.lpstrFilter = L"Easy Draw board (*.edb)\0*.edb\0All files\0*.*\0";
+	ofn.lpstrFile = file;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.lpstrInitialDir = dir.c_str();
+	ofn.lpstrDefExt = L"edb";
+	ofn.Flags = OFN_NOCHANGEDIR | OFN_PATHMUSTEXIST | (save ? OFN_OVERWRITEPROMPT : OFN_FILEMUSTEXIST);
+	if (!(save ? GetSaveFileNameW(&ofn) : GetOpenFileNameW(&ofn))) return false;
+	path = file;
+	return true;
+}
+static void SaveBoardInteractive() {
+	if (g_textMode) CommitText();
+	if (g_drawing) EndStroke();
+	wstring path;
+	if (!PickBoardPath(true, path)) return;
+	ShowToast(SaveBoard(g_cmds, path) ? L"Board saved." : L"Board save failed.");
+	RenderFrame(false);
+}
+// Loading replaces the board like D followed by drawing it back, so Undo returns to the old one.
+static void LoadBoardInteractive() {
+	if (g_textMode) CommitText();
+	if (g_drawing) EndStroke();
+	wstring path;
+	if (!PickBoardPath(false, path)) return;
+	vector<Command> cmds;
+	if (!LoadBoard(path, cmds)) {
+		ShowToast(L"Not an Easy Draw board.");
+		RenderFrame(false);
+		return;
 	}
-	HDC mdc = CreateCompatibleDC(sdc);
-	if (!mdc) {
-		ReleaseDC(nullptr, sdc);
-		g_ssBusy = false;
-		return false;
+	ReplaceBoard(std::move(cmds));
+	RepaintContent();
+	ShowToast(L"Board loaded.");
+	RenderFrame(false);
+}
+
+// ---------- Replay viewer ----------
+// Ctrl+H plays the session back on the content layer. The overlay goes click-through while
+// replaying and the live board is left alone; leaving the replay repaints it.
+static const uint32_t REPLAY_SEEK_MS = 5000;
+static const uint32_t REPLAY_MAX_GAP_MS = 2000;   // longer pauses in the session play this long
+static void ReplaySetPlaying(bool on) {
+	g_rpPlaying = on;
+	g_rpLastTick = GetTickCount64();
+	if (on) SetTimer(g_hwnd, REPLAY_TIMER_ID, 15, nullptr);
+	else KillTimer(g_hwnd, REPLAY_TIMER_ID);
+}
+static void ToggleReplay() {
+	if (g_replaying) {
+		ReplaySetPlaying(false);
+		g_replaying = false;
+		vector<uint32_t>().swap(g_rpBoard);
+		DropRasterBitmaps(g_histCmds);
+		RepaintContent();
+		if (!g_rpWasPass) ToggleOverlay();
+		else RenderFrame(false);
+		return;
 	}
-	
-	BITMAPINFO bi{};
-	bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-	bi.bmiHeader.biWidth = vw;
-	bi.bmiHeader.biHeight = -vh;
-	bi.bmiHeader.biPlanes = 1;
-	bi.bmiHeader.biBitCount = 32;
-	bi.bmiHeader.biCompression = BI_RGB;
-	
-	void* dibBits = nullptr;
-	HBITMAP hbmp = CreateDIBSection(sdc, &bi, DIB_RGB_COLORS, &dibBits, nullptr, 0);
-	HGDIOBJ old = hbmp ? SelectObject(mdc, hbmp) : nullptr;
-	
-	bool ok = false;
-	vector<BYTE> frame;
-	int stride = vw * 4;
-	
-	if (hbmp && dibBits) {
-		BitBlt(mdc, 0, 0, vw, vh, sdc, src.left, src.top, SRCCOPY | CAPTUREBLT);
-		
-		frame.resize((size_t)stride * vh);
-		const BYTE* srcBits = (const BYTE*)dibBits;
-		for (int y = 0; y < vh; ++y) {
-			UINT32* d = (UINT32*)(&frame[(size_t)y * stride]);
-			const UINT32* s = (const UINT32*)(srcBits + (size_t)y * vw * 4);
-			for (int x = 0; x < vw; ++x) d[x] = s[x] | 0xFF000000u;
-		}
-		
-		IWICBitmap* wicMem = nullptr;
-		if (SUCCEEDED(g_wic->CreateBitmapFromMemory(vw, vh, GUID_WICPixelFormat32bppPBGRA, stride, (UINT)frame.size(), frame.data(), &wicMem))) {
-			D2D1_BITMAP_PROPERTIES1 props{};
-			props.pixelFormat = { DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED };
-			props.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET;
-			ID2D1Bitmap1* targetBmp = nullptr;
-			if (SUCCEEDED(g_dc->CreateBitmapFromWicBitmap(wicMem, &props, &targetBmp)) && targetBmp) {
-				g_dc->SetTarget(targetBmp);
-				D2D1_MATRIX_3X2_F oldXf;
-				g_dc->GetTransform(&oldXf);
-				g_dc->SetTransform(D2D1::Matrix3x2F::Translation((FLOAT)(g_vx - src.left), (FLOAT)(g_vy - src.top)));
-				
-				g_dc->BeginDraw();
-				for (const auto& c : g_cmds) {
-					if (c.type == CmdType::Stroke) DrawStrokeD2D(c);
-					else DrawTextD2D(c);
-				}
-				if (g_drawing && g_live.type == CmdType::Stroke) DrawStrokeD2D(g_live);
-				if (g_textMode && !g_live.text.empty()) {
-					Command t = g_live;
-					t.type = CmdType::Text;
-					DrawTextD2D(t);
-				}
-				g_dc->EndDraw();
-				g_dc->SetTransform(oldXf);
-				g_dc->SetTarget(g_target);
-				SafeRelease(targetBmp);
-			}
-			SafeRelease(wicMem);
-		}
-		
-		ok = true;
+	if (g_textMode) CommitText();
+	if (g_drawing) EndStroke();
+	if (g_histEvents.empty()) {
+		ShowToast(L"Nothing to replay yet.");
+		RenderFrame(false);
+		return;
 	}
-	
-	if (old) SelectObject(mdc, old);
-	if (hbmp) DeleteObject(hbmp);
-	DeleteDC(mdc);
-	ReleaseDC(nullptr, sdc);
-	
-	if (!ok) {
-		g_ssBusy = false;
+	g_replaying = true;
+	g_rpEnd = g_histEvents.size();
+	g_rpDuration = g_histEvents.back().ms;
+	g_rpApplied = 0;
+	g_rpBoard.clear();
+	RepaintContent();
+	ReplaySeek(0);
+	g_rpWasPass = g_passThrough;
+	if (!g_passThrough) ToggleOverlay();
+	ReplaySetPlaying(true);
+	RenderFrame(false);
+}
+static void ReplayTick() {
+	ULONGLONG now = GetTickCount64();
+	uint32_t step = (uint32_t)std::lround((now - g_rpLastTick) * g_rpSpeed);
+	g_rpLastTick = now;
+	if (g_rpApplied < g_rpEnd && g_histEvents[g_rpApplied].ms > g_rpClock + REPLAY_MAX_GAP_MS) g_rpClock = g_histEvents[g_rpApplied].ms - REPLAY_MAX_GAP_MS;
+	ReplaySeek(g_rpClock + step);
+	if (g_rpClock >= g_rpDuration) ReplaySetPlaying(false);
+	RenderFrame(false);
+}
+// Space play/pause, Left/Right seek 5 s, Home/End, Up/Down speed, Esc leaves.
+static bool ReplayKey(WPARAM vk) {
+	switch (vk) {
+	case VK_SPACE:
+		if (!g_rpPlaying && g_rpClock >= g_rpDuration) ReplaySeek(0);
+		ReplaySetPlaying(!g_rpPlaying);
+		break;
+	case VK_LEFT:
+		ReplaySeek(g_rpClock > REPLAY_SEEK_MS ? g_rpClock - REPLAY_SEEK_MS : 0);
+		break;
+	case VK_RIGHT:
+		ReplaySeek(g_rpClock + REPLAY_SEEK_MS);
+		break;
+	case VK_HOME:
+		ReplaySeek(0);
+		break;
+	case VK_END:
+		ReplaySeek(g_rpDuration);
+		break;
+	case VK_UP:
+		g_rpSpeed = min(32.f, g_rpSpeed * 2.f);
+		break;
+	case VK_DOWN:
+		g_rpSpeed = max(0.25f, g_rpSpeed * 0.5f);
+		break;
+	case VK_ESCAPE:
+		ToggleReplay();
+		return true;
+	default:
 		return false;
 	}
-	
-	wstring path = BuildTimestampedPath(g_screenshotDir);
-	EnsureDirectoryExists(g_screenshotDir);
-	
-	std::thread([path = std::move(path), w = vw, h = vh, stride, data = std::move(frame)]() mutable {
-		CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-		bool okWrite = SavePNGFromMemoryToFile(path.c_str(), w, h, stride, data.data());
-		CoUninitialize();
-		g_ssBusy = false;
-		PostAreaSavedDone(okWrite);
-	}).detach();
-	
+	RenderFrame(false);
 	return true;
 }
 
@@ -1854,6 +6109,9 @@ static inline bool IsCtrlDown() {
 static inline void NormKey(WPARAM& k) {
 	k = (WPARAM)std::toupper((unsigned char)k);
 }
+static inline bool ComboMatches(const Combo& c, WPARAM vk) {
+	return c.vk && vk == c.vk && c.ctrl == IsCtrlDown();
+}
 
 static LRESULT CALLBACK LowLevelKbProc(int nCode, WPARAM wParam, LPARAM lParam) {
 	if (nCode == HC_ACTION) {
@@ -1862,6 +6120,16 @@ static LRESULT CALLBACK LowLevelKbProc(int nCode, WPARAM wParam, LPARAM lParam)
 		NormKey(up);
 		bool down = (wParam == WM_KEYDOWN || wParam == WM_SYSKEYDOWN), upmsg = (wParam == WM_KEYUP || wParam == WM_SYSKEYUP);
 		
+		// While replaying only the replay keys are ours; everything else goes to other apps.
+		if (g_replaying) {
+			if (down && ComboMatches(g_keyReplay, up)) {
+				ToggleReplay();
+				return 1;
+			}
+			if (down && ReplayKey(up)) return 1;
+			return CallNextHookEx(nullptr, nCode, wParam, lParam);
+		}
+		
 		if (down && g_keyToggle.ctrl && IsCtrlDown() && up == g_keyToggle.vk) {
 			ToggleOverlay();
 			g_swallowToggleKey = true;
@@ -1881,10 +6149,50 @@ static LRESULT CALLBACK LowLevelKbProc(int nCode, WPARAM wParam, LPARAM lParam)
 			}
 			g_areaShot = true;
 			g_areaSelecting = false;
+			g_areaToClipboard = false;
+			RenderFrame(false);
+			return 1;
+		}
+		
+		if (down && ComboMatches(g_keyClipAreaShot, up) && !g_passThrough && !g_textMode && !g_magnify) {
+			g_areaShot = true;
+			g_areaSelecting = false;
+			g_areaToClipboard = true;
 			RenderFrame(false);
 			return 1;
 		}
 		
+		if (down && ComboMatches(g_keyClipShot, up) && !g_passThrough && !g_textMode) {
+			CopyFullScreenshotToClipboard();
+			return 1;
+		}
+		
+		if (down && ComboMatches(g_keyTimelapse, up) && !g_passThrough && !g_textMode) {
+			ToggleTimelapse();
+			return 1;
+		}
+		
+		// The file dialogs are modal, so they run from the window proc rather than inside the hook.
+		if (down && ComboMatches(g_keyBoardSave, up) && !g_passThrough && !g_textMode) {
+			PostMessageW(g_hwnd, WM_COMMAND, IDM_TRAY_SAVEBOARD, 0);
+			return 1;
+		}
+		
+		if (down && ComboMatches(g_keyBoardLoad, up) && !g_passThrough && !g_textMode) {
+			PostMessageW(g_hwnd, WM_COMMAND, IDM_TRAY_LOADBOARD, 0);
+			return 1;
+		}
+		
+		if (down && ComboMatches(g_keyReplay, up) && !g_passThrough && !g_textMode) {
+			ToggleReplay();
+			return 1;
+		}
+		
+		if (down && ComboMatches(g_keyInkShot, up) && !g_passThrough && !g_textMode) {
+			ExportAnnotationsAsync();
+			return 1;
+		}
+		
 		if (down && up == g_keyScreenshot && !g_passThrough && !g_textMode) {
 			TakeScreenshotAsync();
 			return 1;
@@ -1948,8 +6256,17 @@ static LRESULT CALLBACK LowLevelKbProc(int nCode, WPARAM wParam, LPARAM lParam)
 				DeleteAll();
 				return 1;
 			}
+			if (ComboMatches(g_keyObjectEraser, up)) {
+				bool on = !(g_eraser && g_objectEraser);
+				g_eraser = on;
+				g_objectEraser = on;
+				if (on) g_prevEraserSize = g_eraserSize;
+				RenderFrame(true);
+				return 1;
+			}
 			if (up == g_keyEraser) {
 				g_eraser = !g_eraser;
+				g_objectEraser = false;
 				if (g_eraser) g_prevEraserSize = g_eraserSize;
 				RenderFrame(true);
 				return 1;
@@ -1973,7 +6290,11 @@ static LRESULT CALLBACK LowLevelKbProc(int nCode, WPARAM wParam, LPARAM lParam)
 			}
 		}
 		if (upmsg) {
-			if ((g_keyUndo.ctrl && up == g_keyUndo.vk) || (g_keyRedo.ctrl && up == g_keyRedo.vk) || up == g_keyDeleteAll || up == g_keyEraser || up == g_keyScreenshot || g_styleKeys.count(up))
+			// Ctrl combos only: their letters must stay usable as plain keys in other apps.
+			auto ctrlUp = [up](const Combo& c) { return c.ctrl && up == c.vk; };
+			if (ctrlUp(g_keyUndo) || ctrlUp(g_keyRedo) || up == g_keyDeleteAll || up == g_keyEraser || up == g_keyScreenshot
+				|| ctrlUp(g_keyInkShot) || ctrlUp(g_keyClipShot) || ctrlUp(g_keyClipAreaShot) || ctrlUp(g_keyTimelapse)
+				|| ctrlUp(g_keyBoardSave) || ctrlUp(g_keyBoardLoad) || ctrlUp(g_keyReplay) || ctrlUp(g_keyObjectEraser) || g_styleKeys.count(up))
 				return 1;
 		}
 	}
@@ -2040,6 +6361,107 @@ static LRESULT CALLBACK LowLevelMouseProc(int nCode, WPARAM wParam, LPARAM lPara
 	return CallNextHookEx(nullptr, nCode, wParam, lParam);
 }
 
+// ---------- Memory budget ----------
+// Byte counts per subsystem, measured on demand (capacity, not size, since that is what is
+// held). GPU surfaces are estimated at 4 bytes per pixel. Past MEMORY_BUDGET_MB the idle pass
+// gives memory back in order of least loss: the redo stack, then the older half of the session
+// history (repeatedly), then the oldest undo steps that hold commands (erases, D and
+// board-load snapshots), then flattening what became sealed.
+struct MemoryUsage {
+	size_t board = 0, undo = 0, redo = 0, history = 0, text = 0, journal = 0;
+	size_t points = 0, raster = 0, gpu = 0, capture = 0;
+	size_t Total() const { return board + undo + redo + history + text + journal + points + raster + gpu + capture; }
+};
+size_t g_memTrimRedo = 0, g_memTrimHistory = 0, g_memTrimUndo = 0, g_memFlattens = 0;
+
+static size_t CommandsBytes(const vector<Command>& cmds) {
+	size_t n = (cmds.capacity() - cmds.size()) * sizeof(Command);
+	for (const Command& c : cmds) n += CommandBytes(c);
+	return n;
+}
+static size_t EditOpBytes(const EditOp& op) {
+	return sizeof(EditOp) - sizeof(Command) + CommandBytes(op.cmd) + op.at.capacity() * sizeof(uint32_t) + CommandsBytes(op.cmds);
+}
+static MemoryUsage MeasureMemory() {
+	MemoryUsage m;
+	m.board = CommandsBytes(g_cmds) + g_objHidden.capacity() + g_grid.cells.capacity() * sizeof(g_grid.cells[0]) + g_grid.stamp.capacity() * sizeof(uint32_t);
+	for (const auto& cell : g_grid.cells) m.board += cell.capacity() * sizeof(uint32_t);
+	for (const EditOp& op : g_undoOps) m.undo += EditOpBytes(op);
+	for (const EditOp& op : g_redoOps) m.redo += EditOpBytes(op);
+	m.history = CommandsBytes(g_histCmds) + g_histEvents.capacity() * sizeof(HistEvent) + g_histBoard.capacity() * sizeof(uint32_t) + g_rpBoard.capacity() * sizeof(uint32_t);
+	for (const HistKeyframe& k : g_histKeys) m.history += sizeof(k) + k.board.capacity() * sizeof(uint32_t);
+	for (const HistErase& e : g_histErases) m.history += sizeof(e) + (e.at.capacity() + e.ids.capacity()) * sizeof(uint32_t);
+	for (const TextOp& op : g_textUndoOps) m.text += sizeof(op) + op.span.capacity() * sizeof(wchar_t);
+	for (const TextOp& op : g_textRedoOps) m.text += sizeof(op) + op.span.capacity() * sizeof(wchar_t);
+	{
+		std::lock_guard<std::mutex> lk(g_jrMutex);
+		m.journal = g_jrPending.capacity() + g_jrRewrite.capacity();
+	}
+	m.journal += g_jrScratch.capacity() + g_jrRec.buf.capacity();
+	m.points = g_ptArenaBytes.load();
+	// Decoded layers wherever they are held; a layer shared by several commands counts once.
+	static vector<const RasterLayer*> layers;
+	layers.clear();
+	auto noteLayers = [](const vector<Command>& cmds) {
+		for (const Command& c : cmds)
+			if (c.raster && c.raster->bmp) layers.push_back(c.raster.get());
+	};
+	noteLayers(g_cmds);
+	noteLayers(g_histCmds);
+	for (auto* ops : { &g_undoOps, &g_redoOps })
+		for (const EditOp& op : *ops) noteLayers(op.cmds);
+	std::sort(layers.begin(), layers.end());
+	layers.erase(std::unique(layers.begin(), layers.end()), layers.end());
+	for (const RasterLayer* r : layers) m.raster += (size_t)r->w * r->h * 4;
+	// Two buffers per monitor surface, the allocated content tiles and the readback bitmap.
+	m.gpu = g_tileCount * CONTENT_TILE * CONTENT_TILE * 4;
+	for (const Surface& s : g_surfaces) m.gpu += (size_t)(s.rc.right - s.rc.left) * (s.rc.bottom - s.rc.top) * 4 * 2;
+	if (g_readbackBmp) {
+		D2D1_SIZE_U sz = g_readbackBmp->GetPixelSize();
+		m.gpu += (size_t)sz.width * sz.height * 4;
+	}
+	{
+		std::lock_guard<std::mutex> lock(g_poolMutex);
+		m.capture = CapturePoolBytesLocked();
+	}
+	return m;
+}
+// Idle pass (COMPACT_TIMER_ID); MEMORY_BUDGET_MB 0 turns it off.
+static void EnforceMemoryBudget() {
+	if (g_memBudgetMB <= 0 || g_compactBusy || g_drawing || g_replaying) return;
+	const size_t budget = (size_t)g_memBudgetMB << 20;
+	MemoryUsage m = MeasureMemory();
+	if (m.Total() <= budget) return;
+	size_t over = m.Total() - budget;
+	if (!g_redoOps.empty()) {
+		ClearRedo();
+		over -= min(over, m.redo);
+		++g_memTrimRedo;
+	}
+	while (over && TrimHistory()) {
+		const size_t total = MeasureMemory().Total();
+		over = total > budget ? total - budget : 0;
+		++g_memTrimHistory;
+	}
+	auto holdsCommands = [](const EditOp& op) { return !op.cmds.empty(); };
+	// What a step frees is measured, not estimated: its points may share arena chunks with
+	// commands still held elsewhere.
+	while (over && std::any_of(g_undoOps.begin(), g_undoOps.end(), holdsCommands)) {
+		g_undoOps.pop_front();
+		++g_memTrimUndo;
+		const size_t total = MeasureMemory().Total();
+		over = total > budget ? total - budget : 0;
+	}
+	if (!over) return;
+	const uint32_t n = (uint32_t)SealedPrefix();
+	for (uint32_t i = 0; i < n; ++i)
+		if (g_cmds[i].type != CmdType::Raster) {
+			FlattenPrefix(n);
+			++g_memFlattens;
+			break;
+		}
+}
+
 // ---------- Tray ----------
 static void TrayAdd() {
 	if (!g_hTrayIcon) {
@@ -2068,6 +6490,11 @@ static void TrayShowMenu() {
 	HMENU menu = CreatePopupMenu();
 	if (!menu) return;
 	AppendMenuW(menu, MF_STRING, IDM_TRAY_OPENCFG, L"Open config.txt");
+	AppendMenuW(menu, MF_STRING, IDM_TRAY_EXPORTINK, L"Save annotations as PNG");
+	AppendMenuW(menu, MF_STRING, IDM_TRAY_SAVEBOARD, L"Save board...");
+	AppendMenuW(menu, MF_STRING, IDM_TRAY_LOADBOARD, L"Load board...");
+	AppendMenuW(menu, MF_STRING, IDM_TRAY_TIMELAPSE, g_tlRunning ? L"Stop timelapse" : L"Start timelapse");
+	AppendMenuW(menu, MF_STRING, IDM_TRAY_TELEMETRY, L"Open telemetry.txt");
 	AppendMenuW(menu, MF_SEPARATOR, 0, nullptr);
 	AppendMenuW(menu, MF_STRING, IDM_TRAY_EXIT,    L"Exit");
 	POINT pt;
@@ -2099,15 +6526,51 @@ static void OpenConfig() {
 			out << "ERASER_SIZE 10 290 40 30\n\n";
 			out << "MAGNIFY 1 5 1 2\n\n";
 			out << "HIGHLIGHT_ALPHA 50\n";
-			out << "HIGHLIGHT_WIDTH_MULTIPLE 10\n\n";
+			out << "HIGHLIGHT_WIDTH_MULTIPLE 10\n";
+			out << "# INK_PREDICT_MS: draw the line up to this many ms ahead of the pen to hide input\n";
+			out << "# latency; the guess is replaced as real samples arrive (0 = off, max 50)\n";
+			out << "INK_PREDICT_MS 0\n\n";
 			out << "DELETE D\n";
 			out << "ERASE  E\n";
+			out << "OBJECT_ERASER Ctrl+E\n";
 			out << "UNDO   Ctrl+Z\n";
 			out << "REDO   Ctrl+A\n";
 			out << "TOGGLE Ctrl+2\n";
 			out << "MAGNIFIER M\n";
 			out << "SCREENSHOT S\n";
 			out << "SCREENSHOT_AREA Ctrl+S\n";
+			out << "SCREENSHOT_ANNOTATIONS Ctrl+N\n";
+			out << "CLIPBOARD_SCREENSHOT X\n";
+			out << "CLIPBOARD_SCREENSHOT_AREA Ctrl+X\n";
+			out << "TIMELAPSE Ctrl+T\n";
+			out << "TIMELAPSE_INTERVAL 30\n";
+			out << "BOARD_SAVE Ctrl+F\n";
+			out << "BOARD_LOAD Ctrl+L\n";
+			out << "REPLAY Ctrl+H\n";
+			out << "# JOURNAL 1 keeps a crash-recovery log of the drawing (0 = off)\n";
+			out << "JOURNAL 1\n";
+			out << "# UNDO_DEPTH: how many edits Ctrl+Z can take back (0 = unlimited). With a limit, older\n";
+			out << "# erased strokes are compacted away in the background and FLATTEN_MB applies.\n";
+			out << "UNDO_DEPTH 0\n";
+			out << "# FLATTEN_MB: once drawing older than that holds this many MB, it is merged into\n";
+			out << "# one image and repaints no longer replay it (0 = never)\n";
+			out << "FLATTEN_MB 4\n";
+			out << "# MEMORY_BUDGET_MB: above this, redo, then old undo steps, then older drawing are\n";
+			out << "# given up to save memory (0 = no limit). Counts show in the tray's telemetry dump.\n";
+			out << "MEMORY_BUDGET_MB 1024\n";
+			out << "# SCREENSHOT_MODE desktop | cursor | monitor <N>\n";
+			out << "SCREENSHOT_MODE desktop\n";
+			out << "# SCREENSHOT_SCALE <percent>, SCREENSHOT_THUMBNAIL <width px, 0 = off>\n";
+			out << "SCREENSHOT_SCALE 100\n";
+			out << "SCREENSHOT_THUMBNAIL 0\n";
+			out << "SCREENSHOT_BUFFERS 2\n";
+			out << "# SCREENSHOT_QUEUE_MB: screenshots still being saved may hold this much memory\n";
+			out << "# before new ones are refused (one is always accepted)\n";
+			out << "SCREENSHOT_QUEUE_MB 512\n";
+			out << "SCREENSHOT_ENCODERS 2\n";
+			out << "# SCREENSHOT_FORMAT png | png_fast | qoi | png_wic\n";
+			out << "SCREENSHOT_FORMAT png\n";
+			out << "PNG_LEVEL 4\n";
 			out << "SCREENSHOT_PATH \"" << Utf8FromWide(GetDefaultPicturesDir()) << "\"\n\n";
 			out << "USE_NEW_CURSOR true\n";
 			out << "CURSOR_SIZE 60\n";
@@ -2122,6 +6585,51 @@ static void OpenConfig() {
 	ShellExecuteW(g_hwnd, L"open", L"config.txt", nullptr, nullptr, SW_SHOWNORMAL);
 }
 
+// Dumps runtime counters next to config.txt and opens them.
+static void WriteTelemetry() {
+	{
+		std::ofstream out("telemetry.txt", std::ios::binary | std::ios::trunc);
+		if (!out) return;
+		std::lock_guard<std::mutex> lock(g_poolMutex);
+		size_t busy = 0;
+		for (const CaptureSlot& s : g_pool) busy += s.inUse ? 1 : 0;
+		out << "# Easy Draw telemetry\n";
+		out << "capture_slots        " << g_ssPoolSlots << " (" << busy << " busy)\n";
+		out << "capture_bytes        " << CapturePoolBytesLocked() << "\n";
+		out << "capture_peak_bytes   " << g_poolPeakBytes << "\n";
+		out << "captures             " << g_poolCaptures << "\n";
+		out << "captures_refused     " << g_poolRefused << "\n";
+		out << "captures_peak_queued " << g_poolPeakBusy << " (limit " << g_ssQueueMB << " MB)\n";
+		out << "saved                " << g_shotsSaved.load() << "\n";
+		out << "save_failures        " << g_shotsFailed.load() << "\n";
+	}
+	{
+		std::ofstream out("telemetry.txt", std::ios::binary | std::ios::app);
+		if (!out) return;
+		MemoryUsage m = MeasureMemory();
+		out << "\n# Memory (bytes)\n";
+		out << "mem_board            " << m.board << " (" << g_cmds.size() << " commands)\n";
+		out << "mem_undo             " << m.undo << " (" << g_undoOps.size() << " steps)\n";
+		out << "mem_redo             " << m.redo << " (" << g_redoOps.size() << " steps)\n";
+		out << "mem_history          " << m.history << " (" << g_histEvents.size() << " events)\n";
+		out << "mem_text_undo        " << m.text << "\n";
+		out << "mem_journal          " << m.journal << "\n";
+		out << "mem_raster           " << m.raster << "\n";
+		out << "mem_point_arena      " << m.points << " (" << g_ptArenaChunks.load() << " chunks, shared by board, undo and history)\n";
+		out << "mem_gpu_surfaces     " << m.gpu << " (" << g_surfaces.size() << " monitor surfaces, " << g_tileCount << " of " << g_tiles.size() << " content tiles)\n";
+		out << "mem_capture          " << m.capture << "\n";
+		out << "mem_total            " << m.Total() << " (budget " << ((size_t)max(0, g_memBudgetMB) << 20) << ")\n";
+		out << "budget_redo_trims    " << g_memTrimRedo << "\n";
+		out << "budget_history_trims " << g_memTrimHistory << "\n";
+		out << "budget_undo_trims    " << g_memTrimUndo << "\n";
+		out << "budget_flattens      " << g_memFlattens << "\n";
+#if EASY_DRAW_COUNT_ALLOCS
+		out << "heap_allocations     " << g_allocCount << " (UI thread)\n";
+#endif
+	}
+	ShellExecuteW(g_hwnd, L"open", L"telemetry.txt", nullptr, nullptr, SW_SHOWNORMAL);
+}
+
 // ---------- Window proc ----------
 static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 	if (msg == g_msgTaskbarCreated) {
@@ -2150,29 +6658,57 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 			RenderFrame(false);
 			return 0;
 		}
+		if (wParam == REPLAY_TIMER_ID) {
+			ReplayTick();
+			return 0;
+		}
+		if (wParam == COMPACT_TIMER_ID) {
+			KillTimer(hWnd, COMPACT_TIMER_ID);
+			EnforceMemoryBudget();
+			if (!StartCompaction()) FlattenIfDue();
+			return 0;
+		}
+		if (wParam == PACE_TIMER_ID) {
+			KillTimer(hWnd, PACE_TIMER_ID);
+			RenderStaleSurfaces();
+			return 0;
+		}
 		break;
 		
-		case WM_APP_SAVEDONE: {
-			if (wParam) {
-				ShowToast(L"Screenshot Saved.");
-				RenderFrame(false);
-			}
+		case WM_APP_SAVEDONE:
+			OnShotDone(wParam != 0, (uint32_t)lParam);
 			return 0;
-		}
-		case WM_APP_AREASAVEDONE: {
-			if (wParam) {
-				ShowToastOnMonitor(L"Screenshot Saved.", g_areaToastMonRect);
-				RenderFrame(false);
-			}
+		
+		case WM_APP_TLREADBACK: {
+			std::unique_ptr<std::shared_ptr<TimelapseReadback>> ref((std::shared_ptr<TimelapseReadback>*)lParam);
+			TimelapseReadback& rb = **ref;
+			if (!rb.cancelled) rb.ok = ReadbackAnnotations(rb.rc, rb.out);
 			return 0;
 		}
+		case WM_APP_TLSTOPPED:
+			OnTimelapseStopped();
+			return 0;
+		case WM_APP_COMPACTED:
+			OnCompactionDone();
+			return 0;
+		
+		case WM_RENDERFORMAT:
+			if (HGLOBAL mem = RenderClipboardFormat((UINT)wParam)) SetClipboardData((UINT)wParam, mem);
+			return 0;
+		case WM_RENDERALLFORMATS:
+			RenderAllClipboardFormats(true);
+			return 0;
+		case WM_DESTROYCLIPBOARD:
+			ReleaseClipboardShot();
+			return 0;
 		
 		case WM_SIZE: {
 			UINT w = LOWORD(lParam), h = HIWORD(lParam);
 			if (w && h && ((int)w != g_w || (int)h != g_h)) {
 				g_w = (int)w;
 				g_h = (int)h;
-				ResizeSwapChain(w, h);
+				BuildSurfaces();
+				ResetContentTiles();
 				RepaintContent();
 				RenderFrame(false);
 			}
@@ -2266,15 +6802,18 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 						RenderFrame(false);
 						return 0;
 					}
-					if (g_drawing) AddToStroke(g_mousePos.x, g_mousePos.y);
-					else if (g_textMode) RenderFrame(true);
-					else RenderFrame(false);
+					if (g_drawing) {
+						NoteInkSample(g_mousePos, PointerTimeMs(pi));
+						AddToStroke(g_mousePos.x, g_mousePos.y);
+					} else RenderFrameAround(g_textMode, D2D1::RectF(0, 0, -1, -1));
 				}
 				return 0;
 			}
-			std::vector<POINTER_INFO> hist(count);
+			static vector<POINTER_INFO> hist;   // reused, so a coalesced batch allocates only when it is the largest yet
+			if (hist.size() < count) hist.resize(count);
 			if (GetPointerInfoHistory(id, &count, hist.data())) {
-				for (UINT32 i = 0; i < count; ++i) {
+				// The history is newest first.
+				for (UINT32 i = count; i-- > 0;) {
 					POINT pt = hist[i].ptPixelLocation;
 					ScreenToClient(hWnd, &pt);
 					D2D1_POINT_2F p = D2D1::Point2F((float)pt.x, (float)pt.y);
@@ -2299,7 +6838,10 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 						}
 						continue;
 					}
-					if (g_drawing) AddToStroke(p.x, p.y);
+					if (g_drawing) {
+						NoteInkSample(p, PointerTimeMs(hist[i]));
+						AddToStroke(p.x, p.y);
+					}
 				}
 				if (g_areaShot && g_areaSelecting) {
 					RenderFrame(false);
@@ -2309,10 +6851,7 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 						UpdateMagnifierPlacementAndSource();
 						RenderFrame(false);
 					}
-				} else if (!g_drawing) {
-					if (g_textMode) RenderFrame(true);
-					else RenderFrame(false);
-				}
+				} else if (!g_drawing) RenderFrameAround(g_textMode, D2D1::RectF(0, 0, -1, -1));
 			}
 			return 0;
 		}
@@ -2447,9 +6986,10 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 				RenderFrame(false);
 				return 0;
 			}
-			if (g_drawing) AddToStroke(x, y);
-			else if (g_textMode) RenderFrame(true);
-			else RenderFrame(false);
+			if (g_drawing) {
+				NoteInkSample(D2D1::Point2F(x, y), (double)(DWORD)GetMessageTime());
+				AddToStroke(x, y);
+			} else RenderFrameAround(g_textMode, D2D1::RectF(0, 0, -1, -1));
 		}
 		return 0;
 		
@@ -2491,13 +7031,7 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 		return 0;
 		
 	case WM_CAPTURECHANGED:
-		if (g_drawing) {
-			g_drawing = false;
-			g_cmds.push_back(g_live);
-			while (!g_redo.empty()) g_redo.pop();
-			RepaintContent();
-			RenderFrame(false);
-		}
+		if (g_drawing) EndStroke();
 		g_armStrokeAfterText = false;
 		g_touchActive = false;
 		g_activePointerId = 0;
@@ -2570,8 +7104,7 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 			}
 			if (g_textMode) {
 				if (!g_live.text.empty()) {
-					g_cmds.push_back(g_live);
-					while (!g_redo.empty()) g_redo.pop();
+					CommitCommand(std::move(g_live));
 					RepaintContent();
 				}
 				g_live = Command{};
@@ -2588,18 +7121,11 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 	case WM_CHAR:
 		if (g_passThrough) break;
 		if (g_textMode) {
+			const uint32_t end = (uint32_t)g_live.text.size();
 			if (wParam == VK_BACK) {
-				if (!g_live.text.empty()) {
-					TextPushUndo();
-					g_live.text.pop_back();
-				}
-			} else if (wParam == L'\r') {
-				TextPushUndo();
-				g_live.text.push_back(L'\n');
-			} else {
-				TextPushUndo();
-				g_live.text.push_back((wchar_t)wParam);
-			}
+				if (end) TextErase(end - 1, 1);
+			} else if (wParam == L'\r') TextInsert(end, L"\n");
+			else TextInsert(end, wstring(1, (wchar_t)wParam));
 			RenderFrame(true);
 		}
 		return 0;
@@ -2615,6 +7141,21 @@ static LRESULT CALLBACK OverlayWndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARA
 		case IDM_TRAY_OPENCFG:
 			OpenConfig();
 			break;
+		case IDM_TRAY_EXPORTINK:
+			ExportAnnotationsAsync();
+			break;
+		case IDM_TRAY_TIMELAPSE:
+			ToggleTimelapse();
+			break;
+		case IDM_TRAY_SAVEBOARD:
+			SaveBoardInteractive();
+			break;
+		case IDM_TRAY_LOADBOARD:
+			LoadBoardInteractive();
+			break;
+		case IDM_TRAY_TELEMETRY:
+			WriteTelemetry();
+			break;
 		case IDM_TRAY_EXIT:
 			PostQuitMessage(0);
 			break;
@@ -2641,9 +7182,20 @@ static void Cleanup() {
 		DestroyCursor(g_hBigCursor);
 		g_hBigCursor = nullptr;
 	}
+	StopTimelapse(true);
+	StopCompaction();
+	StopJournal(true);
+	RenderAllClipboardFormats(true);
+	ReleaseClipboardShot();
+	StopShotPipeline();
+	StopBandPool();
+	FreeCapturePool();
 	SafeRelease(g_roundStroke);
-	SafeRelease(g_contentBmp);
-	SafeRelease(g_target);
+	SafeRelease(g_readbackBmp);
+	FreeLiveTextLayout();
+	FreeLiveStroke();
+	FreeContentTiles();
+	FreeSurfaces();
 	SafeRelease(g_dc);
 	SafeRelease(g_d2dDevice);
 	SafeRelease(g_d2dFactory);
@@ -2651,21 +7203,450 @@ static void Cleanup() {
 	SafeRelease(g_visual);
 	SafeRelease(g_compTarget);
 	SafeRelease(g_dcomp);
-	SafeRelease(g_swap);
 	SafeRelease(g_dxgiFactory);
 	SafeRelease(g_dxgiDevice);
 	SafeRelease(g_immediate);
 	SafeRelease(g_d3d);
 }
 
+// ---------- Benchmarks (Easy_Draw.exe --bench) ----------
+// Runs against the live desktop without creating the overlay and writes bench_output.txt.
+static double BenchNowMs() {
+	static LARGE_INTEGER freq = [] {
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		return f;
+	}();
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart * 1000.0 / freq.QuadPart;
+}
+static void BenchScreenshotFormats(std::ofstream& out) {
+	RECT src{ GetSystemMetrics(SM_XVIRTUALSCREEN), GetSystemMetrics(SM_YVIRTUALSCREEN), 0, 0 };
+	src.right = src.left + GetSystemMetrics(SM_CXVIRTUALSCREEN);
+	src.bottom = src.top + GetSystemMetrics(SM_CYVIRTUALSCREEN);
+	const int w = src.right - src.left, h = src.bottom - src.top;
+	CaptureSlot* slot = AcquireCaptureSlot(w, h, true);
+	bool hidden = false;
+	if (!slot || !CaptureScreenToSlot(src, slot, hidden)) {
+		out << "screenshot formats: capture failed\n";
+		if (slot) ReleaseCaptureSlot(slot);
+		return;
+	}
+	const vector<BYTE> frame(slot->bits, slot->bits + (size_t)w * h * 4);
+	const double rawBytes = (double)w * h * 3;
+	char line[160];
+	snprintf(line, sizeof(line), "# Screenshot encode: %dx%d desktop, %u threads, best of 3\n", w, h, std::thread::hardware_concurrency());
+	out << line << "format        pack_ms   encode_ms         bytes   ratio\n";
+	
+	auto run = [&](const char* name, unsigned pack, const std::function<bool(const ImageView&, vector<uint8_t>&)>& encode) {
+		double bestPack = 1e30, bestEnc = 1e30;
+		size_t bytes = 0;
+		for (int rep = 0; rep < 3; ++rep) {
+			memcpy(slot->bits, frame.data(), frame.size());
+			double t0 = BenchNowMs();
+			ImageView img = PackCaptureSlot(slot, false, pack);
+			double t1 = BenchNowMs();
+			vector<uint8_t> enc;
+			bool ok = encode(img, enc);
+			double t2 = BenchNowMs();
+			if (!ok) {
+				snprintf(line, sizeof(line), "%-12s  failed\n", name);
+				out << line;
+				return;
+			}
+			bestPack = min(bestPack, t1 - t0);
+			bestEnc = min(bestEnc, t2 - t1);
+			bytes = enc.size();
+		}
+		snprintf(line, sizeof(line), "%-12s %8.1f %11.1f %13zu %7.3f\n", name, bestPack, bestEnc, bytes, bytes / rawBytes);
+		out << line;
+	};
+	for (const ImageFormat& f : g_imageFormats) run(f.name, f.pack, f.encode);
+	for (int level : { 1, 6, 9 }) {
+		char name[16];
+		snprintf(name, sizeof(name), "png L%d", level);
+		run(name, PX_PACK_RGB, [level](const ImageView& img, vector<uint8_t>& o) { return EncodePNG(img, level, o); });
+	}
+	run("png 1 thread", PX_PACK_RGB, [](const ImageView& img, vector<uint8_t>& o) { return EncodePNG(img, g_pngLevel, o, 1); });
+	out << "\n";
+	
+	out << "# Box resampler on the same capture, best of 3\n";
+	for (int pct : { 75, 50, 25 }) {
+		const int dw = max(1, w * pct / 100), dh = max(1, h * pct / 100);
+		vector<uint8_t> dst((size_t)dw * dh * 4);
+		double best = 1e30;
+		for (int rep = 0; rep < 3; ++rep) {
+			double t0 = BenchNowMs();
+			ResampleBox(frame.data(), (ptrdiff_t)w * 4, w, h, dst.data(), (ptrdiff_t)dw * 4, dw, dh);
+			best = min(best, BenchNowMs() - t0);
+		}
+		snprintf(line, sizeof(line), "scale %3d%%  %5dx%-5d %8.1f ms\n", pct, dw, dh, best);
+		out << line;
+	}
+	out << "\n";
+	ReleaseCaptureSlot(slot);
+}
+// Synthetic boards of random-walk strokes on the 1/16 px grid (so they round-trip exactly)
+// with a few text labels, saved to %TEMP% and mapped back.
+static void BenchBoards(std::ofstream& out) {
+	wchar_t tmpDir[MAX_PATH];
+	DWORD n = GetTempPathW(MAX_PATH, tmpDir);
+	const wstring path = wstring(tmpDir, n) + L"easy_draw_bench.edb";
+	char line[160];
+	out << "# Board files, best of 3\n";
+	out << "points      strokes   save_ms   load_ms         bytes  bytes/pt  round_trip\n";
+	for (size_t target : { (size_t)100000, (size_t)1000000 }) {
+		vector<Command> board;
+		uint32_t seed = 0x9E3779B9u;
+		auto rnd = [&seed](uint32_t m) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			return seed % m;
+		};
+		size_t pts = 0;
+		while (pts < target) {
+			Command c;
+			c.type = CmdType::Stroke;
+			c.style.color = D2D1::ColorF((float)(rnd(4) * 85) / 255.f, (float)(rnd(4) * 85) / 255.f, 1.f, 1.f);
+			c.style.width = (float)(2 + 2 * rnd(8));
+			c.highlight = rnd(8) == 0;
+			size_t len = min(target - pts, (size_t)(50 + rnd(400)));
+			float x = (float)rnd(3840), y = (float)rnd(2160);
+			for (size_t i = 0; i < len; ++i) {
+				x += (float)((int)rnd(33) - 16) / 4.f;
+				y += (float)((int)rnd(33) - 16) / 4.f;
+				c.pts.push_back(D2D1::Point2F(x, y));
+			}
+			pts += len;
+			board.push_back(std::move(c));
+			if (rnd(20) == 0) {
+				Command t;
+				t.type = CmdType::Text;
+				t.style.color = D2D1::ColorF(1.f, 0.f, 0.f, 1.f);
+				t.textSize = 36.f;
+				t.pos = D2D1::Point2F((float)rnd(3840), (float)rnd(2160));
+				t.text = L"Label \u00e9\u4e2d " + std::to_wstring(board.size());
+				board.push_back(std::move(t));
+			}
+		}
+		double bestSave = 1e30, bestLoad = 1e30;
+		uint64_t bytes = 0;
+		bool same = true;
+		for (int rep = 0; rep < 3 && same; ++rep) {
+			double t0 = BenchNowMs();
+			same = SaveBoard(board, path, &bytes);
+			double t1 = BenchNowMs();
+			vector<Command> back;
+			same = same && LoadBoard(path, back);
+			double t2 = BenchNowMs();
+			bestSave = min(bestSave, t1 - t0);
+			bestLoad = min(bestLoad, t2 - t1);
+			same = same && back.size() == board.size();
+			for (size_t i = 0; same && i < board.size(); ++i) {
+				const Command& a = board[i];
+				const Command& b = back[i];
+				same = a.type == b.type && a.highlight == b.highlight && a.eraser == b.eraser && a.text == b.text && a.textSize == b.textSize &&
+					a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.style.width == b.style.width && !memcmp(&a.style.color, &b.style.color, sizeof(a.style.color)) &&
+					a.pts.size() == b.pts.size() && (a.pts.empty() || !memcmp(a.pts.data(), b.pts.data(), a.pts.size() * sizeof(a.pts[0])));
+			}
+		}
+		snprintf(line, sizeof(line), "%-9zu %9zu %9.1f %9.1f %13llu %9.2f  %s\n", pts, board.size(), bestSave, bestLoad, (unsigned long long)bytes, (double)bytes / pts, same ? "ok" : "MISMATCH");
+		out << line;
+	}
+	out << "\n";
+	DeleteFileW(path.c_str());
+}
+// Replays synthetic pen paths sampled at 240 Hz on whole pixels through PredictInk and
+// compares each guess with where the path really is `horizon` ms later. lag is the error with
+// no prediction (the last sample), err the error with it; overshoot is how far a guess runs
+// past the true point along the direction of travel.
+static void BenchInkPrediction(std::ofstream& out) {
+	struct Path {
+		const char* name;
+		std::function<D2D1_POINT_2F(double)> at;   // t in ms
+	};
+	const double kPi = 3.14159265358979;
+	const Path paths[] = {
+		{ "line", [](double t) { return D2D1::Point2F((float)(100 + 1.2 * t), (float)(100 + 0.7 * t)); } },
+		{ "circle", [kPi](double t) { return D2D1::Point2F((float)(500 + 150 * std::cos(t * 2 * kPi / 800)), (float)(500 + 150 * std::sin(t * 2 * kPi / 800))); } },
+		{ "scribble", [kPi](double t) { return D2D1::Point2F((float)(500 + 200 * std::sin(t * 2 * kPi / 900) + 40 * std::sin(t * 2 * kPi / 170)), (float)(500 + 120 * std::sin(t * 2 * kPi / 610))); } },
+		{ "zigzag", [](double t) {
+			const double ph = std::fmod(t, 300.0), y = ph < 150.0 ? ph : 300.0 - ph;
+			return D2D1::Point2F((float)(100 + 0.8 * t), (float)(300 + 1.5 * y));
+		} },
+		{ "stop-go", [kPi](double t) { return D2D1::Point2F((float)(100 + 150 * (1 - std::cos(t * 2 * kPi / 500))), 400.f); } },
+	};
+	char line[160];
+	out << "# Ink prediction: 240 Hz samples on whole pixels, 1 s per path, error in px\n";
+	out << "path      horizon  predicted   lag_mean   err_mean    err_p95  overshoot_mean  overshoot_max\n";
+	const double step = 1000.0 / 240.0;
+	for (const Path& path : paths)
+		for (int horizon : { 8, 16, 24, 32 }) {
+			vector<InkSample> hist;
+			vector<double> errs;
+			double lagSum = 0, overSum = 0, overMax = 0;
+			size_t predicted = 0, total = 0;
+			for (double t = 0; t <= 1000.0; t += step) {
+				D2D1_POINT_2F p = path.at(t);
+				hist.push_back({ D2D1::Point2F(std::round(p.x), std::round(p.y)), t });
+				const D2D1_POINT_2F truth = path.at(t + horizon), ahead = path.at(t + horizon + 0.5);
+				D2D1_POINT_2F guess = hist.back().p;
+				if (PredictInk(hist.data(), hist.size(), horizon, guess)) {
+					++predicted;
+					double tx = ahead.x - truth.x, ty = ahead.y - truth.y, tl = std::sqrt(tx * tx + ty * ty);
+					if (tl > 1e-9) {
+						const double over = max(0.0, ((guess.x - truth.x) * tx + (guess.y - truth.y) * ty) / tl);
+						overSum += over;
+						overMax = max(overMax, over);
+					}
+				}
+				const D2D1_POINT_2F lastP = hist.back().p;
+				lagSum += std::hypot(lastP.x - truth.x, lastP.y - truth.y);
+				errs.push_back(std::hypot(guess.x - truth.x, guess.y - truth.y));
+				++total;
+			}
+			double errSum = 0;
+			for (double e : errs) errSum += e;
+			std::sort(errs.begin(), errs.end());
+			snprintf(line, sizeof(line), "%-9s %5d ms %9.0f%% %10.2f %10.2f %10.2f %15.2f %14.2f\n", path.name, horizon, 100.0 * predicted / total,
+				lagSum / total, errSum / total, errs[errs.size() * 95 / 100], predicted ? overSum / predicted : 0.0, overMax);
+			out << line;
+		}
+	out << "\n";
+}
+// Draws 10k points (20 strokes of 500) into an offscreen 2048 px target on a bare D2D device,
+// per-segment DrawLine calls against one cached geometry per stroke. Each pass ends with a
+// 1 px readback, so the times include the GPU. Best of 5.
+static void BenchStrokeDraw(std::ofstream& out) {
+	D3D_FEATURE_LEVEL levels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0, D3D_FEATURE_LEVEL_10_0 };
+	D3D_FEATURE_LEVEL flOut{};
+	D2D1_FACTORY_OPTIONS opts{};
+	if (FAILED(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_HARDWARE, nullptr, D3D11_CREATE_DEVICE_BGRA_SUPPORT, levels, (UINT)(sizeof(levels) / sizeof(levels[0])), D3D11_SDK_VERSION, &g_d3d, &flOut, &g_immediate)) ||
+		FAILED(g_d3d->QueryInterface(__uuidof(IDXGIDevice), (void**)&g_dxgiDevice)) ||
+		FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, __uuidof(ID2D1Factory1), &opts, (void**)&g_d2dFactory)) ||
+		FAILED(g_d2dFactory->CreateDevice(g_dxgiDevice, &g_d2dDevice)) ||
+		FAILED(g_d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &g_dc))) {
+		out << "stroke draw: no D2D device\n\n";
+	} else {
+		D2D1_STROKE_STYLE_PROPERTIES ssp{};
+		ssp.startCap = D2D1_CAP_STYLE_ROUND;
+		ssp.endCap   = D2D1_CAP_STYLE_ROUND;
+		ssp.lineJoin = D2D1_LINE_JOIN_ROUND;
+		g_d2dFactory->CreateStrokeStyle(ssp, nullptr, 0, &g_roundStroke);
+		D2D1_BITMAP_PROPERTIES1 props{};
+		props.pixelFormat = { DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED };
+		props.dpiX = 96.f;
+		props.dpiY = 96.f;
+		props.bitmapOptions = D2D1_BITMAP_OPTIONS_TARGET;
+		ID2D1Bitmap1* target = nullptr;
+		ID2D1Bitmap1* cpu = nullptr;
+		g_dc->CreateBitmap(D2D1_SIZE_U{ 2048, 2048 }, nullptr, 0, &props, &target);
+		props.bitmapOptions = D2D1_BITMAP_OPTIONS_CPU_READ | D2D1_BITMAP_OPTIONS_CANNOT_DRAW;
+		g_dc->CreateBitmap(D2D1_SIZE_U{ 1, 1 }, nullptr, 0, &props, &cpu);
+		
+		vector<Command> strokes(20);
+		uint32_t seed = 0x2545F491u;
+		auto rnd = [&seed](uint32_t m) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			return seed % m;
+		};
+		for (Command& c : strokes) {
+			c.type = CmdType::Stroke;
+			c.style.color = D2D1::ColorF(0.2f, 0.4f, 1.f, 1.f);
+			c.style.width = 6.f;
+			float x = (float)(200 + rnd(1648)), y = (float)(200 + rnd(1648)), dir = (float)rnd(628) / 100.f;
+			for (int i = 0; i < 500; ++i) {
+				dir += (float)((int)rnd(41) - 20) / 100.f;
+				x = min(2040.f, max(8.f, x + 3.f * std::cos(dir)));
+				y = min(2040.f, max(8.f, y + 3.f * std::sin(dir)));
+				c.pts.push_back(D2D1::Point2F(x, y));
+			}
+		}
+		auto pass = [&](const std::function<void()>& draw) {
+			double best = 1e30;
+			for (int rep = 0; rep < 5 && target && cpu; ++rep) {
+				double t0 = BenchNowMs();
+				g_dc->SetTarget(target);
+				g_dc->BeginDraw();
+				g_dc->Clear(D2D1::ColorF(0, 0, 0, 0));
+				draw();
+				g_dc->EndDraw();
+				D2D1_POINT_2U at{ 0, 0 };
+				D2D1_RECT_U px{ 0, 0, 1, 1 };
+				D2D1_MAPPED_RECT mapped{};
+				if (SUCCEEDED(cpu->CopyFromBitmap(&at, target, &px)) && SUCCEEDED(cpu->Map(D2D1_MAP_OPTIONS_READ, &mapped))) cpu->Unmap();
+				best = min(best, BenchNowMs() - t0);
+			}
+			return best;
+		};
+		char line[160];
+		out << "# Stroke drawing: 20 strokes x 500 points, 6 px, 2048x2048 target, best of 5\n";
+		out << "style         method                 calls   ms/10k pts\n";
+		for (bool hi : { false, true }) {
+			for (Command& c : strokes) {
+				c.highlight = hi;
+				c.style.color.a = hi ? 0.2f : 1.f;
+				c.geom.reset();
+			}
+			const char* style = hi ? "highlighter" : "pen";
+			double before;
+			size_t beforeCalls = 0;
+			if (hi) {
+				// The previous highlighter path already filled one outline, but widened it on every draw.
+				before = pass([&] {
+					for (Command& c : strokes) {
+						c.geom.reset();
+						DrawStrokeD2D(c);
+					}
+				});
+				beforeCalls = strokes.size();
+			} else {
+				before = pass([&] {
+					ID2D1SolidColorBrush* br = nullptr;
+					g_dc->CreateSolidColorBrush(strokes[0].style.color, &br);
+					for (const Command& c : strokes)
+						for (size_t i = 1; i < c.pts.size(); ++i) g_dc->DrawLine(c.pts[i - 1], c.pts[i], br, c.style.width, g_roundStroke);
+					SafeRelease(br);
+				});
+				for (const Command& c : strokes) beforeCalls += c.pts.size() - 1;
+			}
+			snprintf(line, sizeof(line), "%-13s %-20s %7zu %12.2f\n", style, hi ? "widen every draw" : "DrawLine per segment", beforeCalls, before);
+			out << line;
+			double cold = pass([&] {
+				for (Command& c : strokes) {
+					c.geom.reset();
+					DrawStrokeD2D(c);
+				}
+			});
+			snprintf(line, sizeof(line), "%-13s %-20s %7zu %12.2f\n", style, "geometry, building", strokes.size(), cold);
+			out << line;
+			double warm = pass([&] {
+				for (const Command& c : strokes) DrawStrokeD2D(c);
+			});
+			snprintf(line, sizeof(line), "%-13s %-20s %7zu %12.2f\n", style, "geometry, cached", strokes.size(), warm);
+			out << line;
+			if (!hi) {
+				vector<const Command*> list;
+				for (const Command& c : strokes) list.push_back(&c);
+				double batched = pass([&] { DrawCommandsD2D(list.data(), list.size()); });
+				snprintf(line, sizeof(line), "%-13s %-20s %7d %12.2f\n", style, "batched by style", 1, batched);
+				out << line;
+			}
+		}
+		out << "\n";
+		strokes.clear();
+		g_dc->SetTarget(nullptr);
+		SafeRelease(cpu);
+		SafeRelease(target);
+	}
+	SafeRelease(g_roundStroke);
+	SafeRelease(g_dc);
+	SafeRelease(g_d2dDevice);
+	SafeRelease(g_d2dFactory);
+	SafeRelease(g_dxgiDevice);
+	SafeRelease(g_immediate);
+	SafeRelease(g_d3d);
+}
+// Stroke point storage: per-stroke vectors against PointBuf slices of the point arena.
+// ingest pushes every point one at a time and commits the stroke, as the pen path does; a
+// small block is allocated and kept per stroke either way, standing in for the undo, history
+// and journal records that interleave with strokes on the heap. replay then walks all points
+// in drawing order taking each stroke's bounds, as a repaint does. Best of 5.
+static void BenchPointArena(std::ofstream& out) {
+	char line[160];
+	out << "# Stroke point storage, best of 5\n";
+	out << "points     storage   ingest_ms   Mpts/s   replay_ms  ns/pt   chunks\n";
+	for (size_t target : { (size_t)1000000, (size_t)4000000 }) {
+		vector<uint32_t> lens;
+		uint32_t seed = 0x2545F491u;
+		for (size_t n = 0; n < target;) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			uint32_t len = (uint32_t)min(target - n, (size_t)(50 + seed % 400));
+			lens.push_back(len);
+			n += len;
+		}
+		auto run = [&](auto proto, const char* name) {
+			double bestIn = 1e30, bestRp = 1e30;
+			uint32_t chunks = 0;
+			volatile float sink = 0.f;
+			for (int rep = 0; rep < 5; ++rep) {
+				auto strokes = proto;
+				vector<std::unique_ptr<char[]>> noise;
+				strokes.reserve(lens.size());
+				noise.reserve(lens.size());
+				double t0 = BenchNowMs();
+				float x = 0.f;
+				for (uint32_t len : lens) {
+					typename decltype(strokes)::value_type s;
+					for (uint32_t i = 0; i < len; ++i) {
+						x += 0.25f;
+						s.push_back(D2D1::Point2F(x, x * 0.5f));
+					}
+					s.shrink_to_fit();
+					strokes.push_back(std::move(s));
+					noise.emplace_back(new char[48 + len % 200]);
+				}
+				double t1 = BenchNowMs();
+				for (const auto& s : strokes) {
+					D2D1_RECT_F b{ s[0].x, s[0].y, s[0].x, s[0].y };
+					for (const D2D1_POINT_2F& p : s) {
+						b.left = min(b.left, p.x);
+						b.top = min(b.top, p.y);
+						b.right = max(b.right, p.x);
+						b.bottom = max(b.bottom, p.y);
+					}
+					sink = sink + b.right - b.left + b.bottom - b.top;
+				}
+				double t2 = BenchNowMs();
+				bestIn = min(bestIn, t1 - t0);
+				bestRp = min(bestRp, t2 - t1);
+				chunks = g_ptArenaChunks.load();
+				strokes.clear();
+				ResetPointArena();
+			}
+			snprintf(line, sizeof(line), "%-9zu  %-8s %10.1f %8.1f %11.2f %6.2f %8u\n", target, name, bestIn, target / bestIn / 1000.0, bestRp,
+				bestRp * 1e6 / target, chunks);
+			out << line;
+		};
+		run(vector<vector<D2D1_POINT_2F>>(), "vector");
+		run(vector<PointBuf>(), "arena");
+	}
+	out << "\n";
+}
+static int RunBenchmarks() {
+	std::ofstream out("bench_output.txt", std::ios::binary | std::ios::trunc);
+	if (!out) return 1;
+	BenchScreenshotFormats(out);
+	BenchBoards(out);
+	BenchInkPrediction(out);
+	BenchStrokeDraw(out);
+	BenchPointArena(out);
+	StopBandPool();
+	FreeCapturePool();
+	return 0;
+}
+
 // ---------- Entry ----------
-int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int) {
+int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR cmdLine, int) {
 	EnableDpiAwarenessOnce();
 	CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
 	g_hInst = hInst;
 	
 	LoadConfig();
+	if (cmdLine && wcsstr(cmdLine, L"--bench")) {
+		int rc = RunBenchmarks();
+		CoUninitialize();
+		return rc;
+	}
 	
+	RecoverJournal();
+	StartHistory();
 	g_msgTaskbarCreated = RegisterWindowMessageW(L"TaskbarCreated");
 	
 	int vx = GetSystemMetrics(SM_XVIRTUALSCREEN), vy = GetSystemMetrics(SM_YVIRTUALSCREEN);
@@ -2682,6 +7663,7 @@ int WINAPI wWinMain(HINSTANCE hInst, HINSTANCE, PWSTR, int) {
 	
 	g_hwnd = CreateWindowExW(WS_EX_NOREDIRECTIONBITMAP | WS_EX_TOPMOST | WS_EX_TOOLWINDOW, wc.lpszClassName, L"Easy Draw", WS_POPUP, vx, vy, vw, vh, nullptr, nullptr, hInst, nullptr);
 	if (!g_hwnd) {
+		StopJournal(false);
 		CoUninitialize();
 		return 0;
 	}